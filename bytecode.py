@@ -3,7 +3,7 @@ from collect import *
 import struct
 
 HEADER = '\x07DV'
-VERSION = (0, 3)
+VERSION = (0, 9)
 OP_SIZE = 5
 
 OPCODES = {
@@ -15,15 +15,22 @@ OPCODES = {
 	'SET_GLOBAL':		'00000101',
 	'GET':				'00000110',
 	'GET_GLOBAL':		'00000111',
+	'PUSH_SLOT':		'00001000',
+	'SET_SLOT':			'00001001',
+	'SET_LOCAL_SLOT':	'00001010',
+	'GET_SLOT':			'00001011',
 	'JMP':				'00010000',
 	'JMPZ':				'00010001',
 	'RETURN':			'00010010',
 	'RECURSE':			'00010011',
 	'JMPEQ':			'00010100',
 	'JMPNE':			'00010101',
+	'TAILCALL':		'00010110',
 	'LABDA':			'00100000',
 	'ENTER_SCOPE':		'00100001',
 	'LEAVE_SCOPE':		'00100010',
+	'FLAT_LABDA':		'00100011',
+	'CAPTURE':			'00100100',
 	'NEW_LIST':			'00110000',
 	'POP_FROM':			'00110001',
 	'PUSH_TO':			'00110010',
@@ -44,6 +51,21 @@ OPCODES = {
 	'GET_DICT':			'01110010',
 	'SET_DICT':			'01110011',
 	'CALL':				'10000000',
+	'ADD':				'10010000',
+	'SUB':				'10010001',
+	'MUL':				'10010010',
+	'LT':				'10010011',
+	'GT':				'10010100',
+	'LE':				'10010101',
+	'GE':				'10010110',
+	'EQ':				'10010111',
+	'DUP_JMPZ':			'10100000',
+	'LEAVE_SCOPE_JMP':	'10100001',
+	'LT_JMPZ':			'10100010',
+	'GT_JMPZ':			'10100011',
+	'LE_JMPZ':			'10100100',
+	'GE_JMPZ':			'10100101',
+	'EQ_JMPZ':			'10100110',
 }
 for k in OPCODES:
 	OPCODES[k] = int(OPCODES[k], 2) * 0x1000000
@@ -53,6 +75,8 @@ TYPES = {
 	'str':         '00000001',
 	'num':         '00000010',
 	'frac':        '00000111',
+	'bigint':      '00001000',
+	'bigfrac':     '00001001',
 	'short-ident': '10000000',
 	'short-str':   '10000001',
 	'short-frac':  '10000111',
@@ -88,6 +112,16 @@ def write_code(code, acc):
 	for op in code:
 		acc.append(unsigned_int(OPCODES[op.opcode] | (op.ref & 0xFFFFFF)))
 
+def write_bigint(n, acc):
+	m = abs(n)
+	limbs = []
+	while m:
+		limbs.append(unsigned_int(m & 0xFFFFFFFF))
+		m >>= 32
+	acc.append(unsigned_int(len(limbs)))
+	acc.append(signed_char(-1 if n < 0 else 1))
+	acc.extend(limbs)
+
 def write_literals(literals, acc):
 	for literal in literals:
 		acc.append(TYPES[literal[0]])
@@ -99,9 +133,15 @@ def write_literals(literals, acc):
 				acc[-1] = TYPES['short-frac']
 				acc.append(signed_char(n))
 				acc.append(chr(d))
-			else:
+			elif -2**63 <= n < 2**63 and d < 2**63:
 				acc.append(signed_long_int(n))
 				acc.append(unsigned_long_int(d))
+			else:
+				acc[-1] = TYPES['bigfrac']
+				write_bigint(n, acc)
+				write_bigint(d, acc)
+		elif literal[0] == 'bigint':
+			write_bigint(literal[1], acc)
 		elif len(literal[1]) < 256:
 			acc[-1] = TYPES['short-' + literal[0]]
 			acc.append(chr(len(literal[1])))
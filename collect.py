@@ -1,6 +1,7 @@
 from convert import *
 
-valued_opcodes = set('PUSH_WORD PUSH_LITERAL SET SET_LOCAL SET_GLOBAL GET GET_GLOBAL SOURCE_FILE'.split())
+valued_opcodes = set('PUSH_WORD PUSH_LITERAL SET SET_LOCAL SET_GLOBAL GET GET_GLOBAL SOURCE_FILE CAPTURE'.split()) | WORDED_OPCODES
+slot_opcodes = set(UNSLOTTED)
 
 class Contain(object):
 	def __init__(self, t, value):
@@ -16,7 +17,7 @@ class Bucket(object):
 		if isinstance(v, (ProperWord, Ident)):
 			b = 'ident'
 		elif isinstance(v, Number):
-			b = 'num'
+			b = 'num' if isinstance(v.value, float) else 'bigint'
 		elif isinstance(v, String):
 			b = 'str'
 		elif isinstance(v, Fraction):
@@ -50,9 +51,18 @@ def collect(flat_file):
 	for instruction in flat_file:
 		if instruction.opcode in valued_opcodes:
 			buck.add(instruction.ref)
+		elif instruction.opcode in slot_opcodes:
+			buck.add(instruction.ref[0])
 	buck.sort()
 	buck.number()
 	for instruction in flat_file:
 		if instruction.opcode in valued_opcodes:
 			instruction.ref = buck.get(instruction.ref)
+		elif instruction.opcode in slot_opcodes:
+			ref, slot = instruction.ref
+			instruction.ref = buck.get(ref)
+			if instruction.ref < 0x10000:
+				instruction.ref = instruction.ref << 8 | slot
+			else: #the literal index does not fit next to the slot
+				instruction.opcode = UNSLOTTED[instruction.opcode]
 	return flat_file, buck.raw()
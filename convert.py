@@ -28,10 +28,41 @@ OPTIMIZERS = {
 	'raise': 'RAISE',
 	'reraise': 'RERAISE',
 	'call': 'CALL',
+	'+': 'ADD',
+	'-': 'SUB',
+	'*': 'MUL',
+	'<': 'LT',
+	'>': 'GT',
+	'<=': 'LE',
+	'>=': 'GE',
+	'=': 'EQ',
 }
 ARGED_OPT = set('SET SET_LOCAL SET_GLOBAL GET GET_GLOBAL'.split())
+#these keep their word, so the VM can fall back to it when it is rebound
+WORDED_OPT = set('ADD SUB MUL LT GT LE GE EQ'.split())
 
-positional_instructions = set('JMP JMPZ LABDA JMPEQ JMPNE ENTER_ERRHAND'.split())
+#the first of each pair is replaced, the second stays after it
+SUPERINSTRUCTIONS = {
+	('DUP', 'JMPZ'): 'DUP_JMPZ',
+	('LEAVE_SCOPE', 'JMP'): 'LEAVE_SCOPE_JMP',
+	('LT', 'JMPZ'): 'LT_JMPZ',
+	('GT', 'JMPZ'): 'GT_JMPZ',
+	('LE', 'JMPZ'): 'LE_JMPZ',
+	('GE', 'JMPZ'): 'GE_JMPZ',
+	('EQ', 'JMPZ'): 'EQ_JMPZ',
+}
+WORDED_OPCODES = WORDED_OPT | set(v for k, v in SUPERINSTRUCTIONS.items() if k[0] in WORDED_OPT) | set(['TAILCALL'])
+
+positional_instructions = set('JMP JMPZ LABDA FLAT_LABDA JMPEQ JMPNE ENTER_ERRHAND'.split())
+
+SLOT_OPCODES = {
+	'PUSH_WORD': 'PUSH_SLOT',
+	'SET': 'SET_SLOT',
+	'SET_LOCAL': 'SET_LOCAL_SLOT',
+	'GET': 'GET_SLOT',
+}
+UNSLOTTED = dict((v, k) for k, v in SLOT_OPCODES.items())
+MAX_SLOTS = 256
 
 def convert(filename, flat):
 	bytecode = [SingleInstruction('SOURCE_FILE', String(None, '"' + filename))]
@@ -48,6 +79,8 @@ def convert(filename, flat):
 							else:
 								bytecode.append(SingleInstruction('PUSH_WORD', w))
 								continue
+						elif OPTIMIZERS[w.value] in WORDED_OPT:
+							s = w
 						else:
 							s = 0
 						bytecode.append(SingleInstruction(OPTIMIZERS[w.value], s))
@@ -101,7 +134,7 @@ def convert(filename, flat):
 						])
 					else:
 						bytecode.append(SingleInstruction('PUSH_WORD', w))
-				elif isinstance(w, Number) and w.value.is_integer() and w.value <= POS_SIZE and w.value >= NEG_SIZE:
+				elif isinstance(w, Number) and isinstance(w.value, float) and w.value.is_integer() and w.value <= POS_SIZE and w.value >= NEG_SIZE:
 					bytecode.append(SingleInstruction('PUSH_INTEGER', int(w.value)))
 				else:
 					bytecode.append(SingleInstruction('PUSH_LITERAL', w))
@@ -134,7 +167,54 @@ def get(l, i):
 	except IndexError:
 		return None
 
-def optimize(flattened): #optimize away superfluous RETURN statements
+def in_tail_position(flattened, markers, i): #nothing but leaving scopes and jumping happens between i and a RETURN
+	seen = set()
+	i += 1
+	while i < len(flattened) and i not in seen:
+		seen.add(i)
+		item = flattened[i]
+		if is_return(item):
+			return True
+		elif isinstance(item, Marker) or item.opcode == 'LEAVE_SCOPE':
+			i += 1
+		elif item.opcode == 'JMP':
+			i = markers[item.ref]
+		else:
+			return False
+	return False
+
+def drop_try_scopes(flattened): #a try body that binds nothing needs no scope of its own
+	markers = dict((item, i) for i, item in enumerate(flattened) if isinstance(item, Marker))
+	drop = []
+	for item in flattened:
+		if not isinstance(item, SingleInstruction) or item.opcode != 'ENTER_ERRHAND':
+			continue
+		start = markers[item.ref] + 1
+		depth = 0
+		j = start + 1
+		while True:
+			x = flattened[j]
+			if isinstance(x, Marker):
+				pass
+			elif x.opcode in ('LABDA', 'FLAT_LABDA'):
+				j = markers[x.ref]
+				continue
+			elif x.opcode == 'ENTER_SCOPE':
+				depth += 1
+			elif x.opcode == 'LEAVE_SCOPE' and depth > 0:
+				depth -= 1
+			elif x.opcode == 'LEAVE_SCOPE':
+				drop.extend([start, j])
+				break
+			elif x.opcode == 'SET_LOCAL' and depth == 0 or is_dynamic(x):
+				break
+			j += 1
+	for i in sorted(drop, reverse=True):
+		flattened.pop(i)
+	return flattened
+
+def optimize(flattened): #optimize away superfluous RETURN statements, then fuse common pairs and mark tail calls
+	flattened = drop_try_scopes(flattened)
 	for i, instruction in reversed(list(enumerate(flattened))):
 		if (is_return(instruction) and (is_return(get(flattened, i + 1)) or (isinstance(get(flattened, i + 1), Marker) and is_return(get(flattened, i + 2))))
 		 or isinstance(get(flattened, i + 1), Marker) and is_jump_to(instruction, get(flattened, i + 1))
@@ -143,6 +223,151 @@ def optimize(flattened): #optimize away superfluous RETURN statements
 		 or is_linenr(instruction) and is_linenr(get(flattened, i + 1))
 		):
 			flattened.pop(i)
+	for instruction, following in zip(flattened, flattened[1:]):
+		if isinstance(instruction, SingleInstruction) and isinstance(following, SingleInstruction):
+			instruction.opcode = SUPERINSTRUCTIONS.get((instruction.opcode, following.opcode), instruction.opcode)
+	markers = dict((item, i) for i, item in enumerate(flattened) if isinstance(item, Marker))
+	for i, instruction in enumerate(flattened):
+		if isinstance(instruction, SingleInstruction) and instruction.opcode == 'PUSH_WORD' and in_tail_position(flattened, markers, i):
+			instruction.opcode = 'TAILCALL'
+	return flatten_closures(flattened)
+
+#words that can reach any name, so nothing is known about bindings where they are used
+DYNAMIC_WORDS = set('get set local getglobal setglobal recurse'.split())
+USES_NAME = set('PUSH_WORD TAILCALL GET'.split()) | WORDED_OPCODES
+BINDS_NAME = set('SET SET_LOCAL'.split())
+
+def owners(flattened, markers): #the index of the innermost LABDA around every item, or None
+	acc = []
+	stack = []
+	for i, item in enumerate(flattened):
+		while stack and i >= markers[flattened[stack[-1]].ref]:
+			stack.pop()
+		acc.append(stack[-1] if stack else None)
+		if isinstance(item, SingleInstruction) and item.opcode == 'LABDA':
+			stack.append(i)
+	return acc
+
+def is_dynamic(item):
+	return item.opcode == 'RECURSE' or item.opcode in ('PUSH_WORD', 'TAILCALL') and word_name(item.ref) in DYNAMIC_WORDS
+
+def successors(flattened, markers, i):
+	item = flattened[i]
+	if isinstance(item, Marker):
+		return [i + 1]
+	if item.opcode == 'JMP':
+		return [markers[item.ref]]
+	if item.opcode in ('JMPZ', 'JMPEQ', 'JMPNE', 'ENTER_ERRHAND'):
+		return [i + 1, markers[item.ref]]
+	if item.opcode in ('LABDA', 'FLAT_LABDA'):
+		return [markers[item.ref]]
+	if item.opcode in ('RETURN', 'RAISE', 'RERAISE'):
+		return []
+	return [i + 1]
+
+def rebound_after(flattened, markers, start, end, names): #whether any of names can be bound again from start on, before end
+	seen = set()
+	todo = [start]
+	while todo:
+		i = todo.pop()
+		if i in seen or i >= end:
+			continue
+		seen.add(i)
+		item = flattened[i]
+		if isinstance(item, SingleInstruction) and item.opcode in BINDS_NAME and word_name(item.ref) in names:
+			return True
+		todo.extend(successors(flattened, markers, i))
+	return False
+
+def flatten_closures(flattened):
+	'''A function created inside another one normally keeps the whole scope
+	it was created in alive. It becomes a FLAT_LABDA when it is enough to
+	copy the names it uses from that scope when it is created: they are
+	not bound anywhere after that and not changed with set from anywhere.
+	The names follow its body as CAPTURE instructions.'''
+	markers = dict((item, i) for i, item in enumerate(flattened) if isinstance(item, Marker))
+	owner = owners(flattened, markers)
+	captures = []
+	for i, item in enumerate(flattened):
+		parent = owner[i]
+		if not isinstance(item, SingleInstruction) or item.opcode != 'LABDA' or parent is None:
+			continue
+		end = markers[item.ref]
+		parent_end = markers[flattened[parent].ref]
+		body = [x for x in flattened[i + 1:end] if isinstance(x, SingleInstruction)]
+		family = [x for x in flattened[parent + 1:parent_end] if isinstance(x, SingleInstruction)]
+		top = parent
+		while owner[top] is not None:
+			top = owner[top]
+		if any(isinstance(x, SingleInstruction) and is_dynamic(x) for x in flattened[top + 1:markers[flattened[top].ref]]):
+			continue
+		used = set(word_name(x.ref) for x in body if x.opcode in USES_NAME)
+		bound = {}
+		for j in range(parent + 1, parent_end):
+			x = flattened[j]
+			if isinstance(x, SingleInstruction) and x.opcode == 'SET_LOCAL':
+				bound.setdefault(owner[j], set()).add(word_name(x.ref))
+		outer = owner[parent]
+		bound_further_out = set()
+		while outer is not None:
+			outer_end = markers[flattened[outer].ref]
+			bound_further_out.update(word_name(x.ref) for j, x in enumerate(flattened[outer + 1:outer_end], outer + 1) if owner[j] == outer and isinstance(x, SingleInstruction) and x.opcode == 'SET_LOCAL')
+			outer = owner[outer]
+		names = used & bound.get(parent, set())
+		changed = set(word_name(x.ref) for x in body if x.opcode == 'SET')
+		if used & (bound_further_out - names) or changed & (bound.get(parent, set()) | bound_further_out):
+			continue
+		if any(x.opcode == 'SET' and word_name(x.ref) in names for x in family):
+			continue
+		if rebound_after(flattened, markers, end, parent_end, names):
+			continue
+		item.opcode = 'FLAT_LABDA'
+		captures.append((end, sorted(names)))
+	for end, names in sorted(captures, reverse=True):
+		flattened[end + 1:end + 1] = [SingleInstruction('CAPTURE', name) for name in names]
+	return flattened
+
+def word_name(ref):
+	if isinstance(ref, (ProperWord, Ident)):
+		return ref.value
+	return ref
+
+class Frame(object):
+	def __init__(self, end):
+		self.end = end
+		self.depth = 0
+		self.slots = {}
+		self.instructions = []
+
+def assign_slots(flattened): #names bound at the top level of a function get a slot
+	frames = []
+	stack = []
+	for item in flattened:
+		if isinstance(item, Marker):
+			if stack and item is stack[-1].end:
+				stack.pop()
+			continue
+		if stack:
+			frame = stack[-1]
+			if item.opcode == 'ENTER_SCOPE':
+				frame.depth += 1
+			elif item.opcode == 'LEAVE_SCOPE':
+				frame.depth -= 1
+			elif item.opcode in SLOT_OPCODES or item.opcode in WORDED_OPCODES:
+				name = word_name(item.ref)
+				if item.opcode == 'SET_LOCAL' and frame.depth == 0 and name not in frame.slots and len(frame.slots) < MAX_SLOTS:
+					frame.slots[name] = len(frame.slots)
+				frame.instructions.append((item, frame.depth))
+		if item.opcode in ('LABDA', 'FLAT_LABDA'):
+			stack.append(Frame(item.ref))
+			frames.append(stack[-1])
+	for frame in frames:
+		for item, depth in frame.instructions:
+			name = word_name(item.ref)
+			#SET_LOCAL inside a block binds in the scope of that block
+			if name in frame.slots and (item.opcode != 'SET_LOCAL' or depth == 0):
+				item.opcode = SLOT_OPCODES.get(item.opcode, 'PUSH_SLOT')
+				item.ref = (item.ref, frame.slots[name])
 	return flattened
 
 def refine(flattened): #removes all markers and replaces them by indices
@@ -8,7 +8,8 @@ DECODE_OPCODES = {}
 for k in OPCODES:
 	DECODE_OPCODES[OPCODES[k] / 0x1000000] = k
 
-WORD_ARG = set('GET SET GET_GLOBAL SET_GLOBAL SET_LOCAL PUSH_LITERAL PUSH_WORD SOURCE_FILE'.split())
+WORD_ARG = set('GET SET GET_GLOBAL SET_GLOBAL SET_LOCAL PUSH_LITERAL PUSH_WORD TAILCALL CAPTURE SOURCE_FILE ADD SUB MUL LT GT LE GE EQ LT_JMPZ GT_JMPZ LE_JMPZ GE_JMPZ EQ_JMPZ'.split())
+SLOT_ARG = set('PUSH_SLOT SET_SLOT SET_LOCAL_SLOT GET_SLOT'.split())
 POS_ARG = positional_instructions
 
 def d_unsigned_int(x):
@@ -36,6 +37,12 @@ def d_signed_int(x):
 def d_double(x):
 	return double_s.unpack(x)[0]
 
+def d_bigint(x):
+	n = 0
+	for i in reversed(range(unsigned_int(x[:4]))):
+		n = (n << 32) | unsigned_int(x[5 + 4 * i:9 + 4 * i])
+	return -n if signed_char(x[4]) < 0 else n
+
 class Literals(object):
 	def __init__(self, source):
 		self.source = source
@@ -75,6 +82,15 @@ class Literals(object):
 				d = ord(self.source[2])
 				b = str(n) + '/' + str(d)
 				self.source = self.source[3:]
+			elif s == '\x08':
+				b = d_bigint(self.source[1:])
+				self.source = self.source[6 + 4 * unsigned_int(self.source[1:5]):]
+			elif s == '\x09':
+				n = d_bigint(self.source[1:])
+				self.source = self.source[5 + 4 * unsigned_int(self.source[1:5]):]
+				d = d_bigint(self.source[1:])
+				self.source = self.source[6 + 4 * unsigned_int(self.source[1:5]):]
+				b = str(n) + '/' + str(d)
 			self.cache.append(b)
 		return self.cache[item]
 
@@ -82,6 +98,9 @@ def make_line_00(i, x, literals):
 	op = DECODE_OPCODES[ord(x[0])]
 	if op in WORD_ARG:
 		arg = literals[d_unsigned_int(x[1:])]
+	elif op in SLOT_ARG:
+		n = d_unsigned_int(x[1:])
+		arg = '%s @%d' % (literals[n >> 8], n & 255)
 	elif op == 'PUSH_INTEGER':
 		arg = d_signed_int(x[1:])
 	elif op in POS_ARG:
@@ -104,7 +123,7 @@ def dis_00(text):
 def dis(text):
 	if not text.startswith('\x07DV'):
 		raise Exception("Not a Deja Vu byte code file.")
-	elif text[3] in ('\x00', '\x01', '\x02', '\x03'):
+	elif text[3] in ('\x00', '\x01', '\x02', '\x03', '\x04', '\x05', '\x06', '\x07', '\x08', '\x09'):
 		return dis_00(text[4:])
 	else:
 		raise Exception("Byte code version not recognised.")
@@ -163,7 +163,9 @@ def flatten(tree, acc=None):
 				acc.extend([GoTo(m_end), h_end])
 			acc.append(SingleInstruction('RERAISE', 0))
 			acc.append(m_body)
+			acc.append(SingleInstruction('ENTER_SCOPE', 0))
 			flatten(branch.tryclause, acc)
+			acc.append(SingleInstruction('LEAVE_SCOPE', 0))
 			acc.append(SingleInstruction('LEAVE_ERRHAND', 0))
 			acc.append(m_end)
 	return acc
@@ -48,8 +48,16 @@ class String(Word):
 	def __str__(self):
 		return '"' + self.value + '"'
 
+# the range of a tagged int in the VM
+MIN_INT = -(1 << 62)
+MAX_INT = (1 << 62) - 1
+
 class Number(Word):
 	def convert(self, value):
+		if '.' not in value:
+			n = int(value)
+			if not MIN_INT < n < MAX_INT or float(n) != n:
+				return n
 		return float(value)
 
 class Ident(Word):
@@ -6,7 +6,7 @@ DECODE_OPCODES = {}
 for k in OPCODES:
     DECODE_OPCODES[OPCODES[k] / 0x1000000] = k
 
-ops_with_arg = valued_opcodes | set(['LINE_NUMBER', 'PUSH_INTEGER'])
+ops_with_arg = valued_opcodes | slot_opcodes | set(['LINE_NUMBER', 'PUSH_INTEGER'])
 
 def d_signed_int(x):
     if x[0] >= '\x80':
@@ -42,6 +42,14 @@ def make_line_00(i, op, arg, labels):
 def unsigned_int(x):
     return unsigned_int_s.unpack(x)[0]
 
+# the BigInt after code[i], and the index of its last byte
+def read_bigint(code, i):
+    size = unsigned_int(code[i+1:i+5])
+    n = 0
+    for j in reversed(range(size)):
+        n = (n << 32) | unsigned_int(code[i+6+4*j:i+10+4*j])
+    return (-n if code[i+5] >= '\x80' else n), i + 5 + 4 * size
+
 def get_literals(code):
     i = 0
     while i < len(code):
@@ -78,6 +86,13 @@ def get_literals(code):
             d = ord(code[i+2])
             yield 'f' + str(n) + '/' + str(d)
             i += 3
+        elif s == '\x08':
+            n, i = read_bigint(code, i)
+            yield 'n' + str(n)
+        elif s == '\x09':
+            n, i = read_bigint(code, i)
+            d, i = read_bigint(code, i)
+            yield 'f' + str(n) + '/' + str(d)
         i += 1
 
 def dis_00(bc):
@@ -93,7 +108,7 @@ def dis_00(bc):
 def dis(bc):
     if not bc.startswith('\x07DV'):
         raise Exception("Not a Deja Vu byte code file.")
-    elif bc[3] in '\x00\x01\x02\x03':
+    elif bc[3] in '\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09':
         return dis_00(bc[4:])
     else:
         raise Exception("Byte code version not recognised.")
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "alloc.h"
+
+/* A size-class allocator for values.
+ * Every size class has a free list of cells. Empty free lists are
+ * refilled by bumping a pointer through an arena chunk, so freshly
+ * allocated values of any small size (doubles, pairs, fractions, lists,
+ * dicts, scopes, short strings) end up next to each other.
+ * Chunks are never given back to the system.
+ * Larger values go straight to malloc.
+ */
+
+#define ARENA_CHUNK (64 * 1024)
+
+// the first word is left alone, so the header of a freed value
+// still reads as Black while the collector finishes a cycle
+typedef struct Cell
+{
+	void *header;
+	struct Cell *next;
+} Cell;
+
+static Cell *free_cells[POOL_CLASSES];
+static char *arena_next = NULL;
+static char *arena_end = NULL;
+
+static struct
+{
+	unsigned long allocs[POOL_CLASSES];
+	unsigned long frees[POOL_CLASSES];
+	unsigned long large_allocs;
+	unsigned long large_frees;
+	unsigned long chunks;
+} stats;
+
+static void* arena_alloc(size_t size)
+{
+	if (arena_next == NULL || arena_next + size > arena_end)
+	{ // the rest of the old chunk is lost
+		arena_next = malloc(ARENA_CHUNK);
+		arena_end = arena_next + ARENA_CHUNK;
+		stats.chunks++;
+	}
+	void *p = arena_next;
+	arena_next += size;
+	return p;
+}
+
+void* pool_alloc(size_t size)
+{
+	if (size > POOL_GRANULE * POOL_CLASSES)
+	{
+		stats.large_allocs++;
+		return malloc(size);
+	}
+	int c = (size - 1) / POOL_GRANULE;
+	Cell *cell = free_cells[c];
+	stats.allocs[c]++;
+	if (cell == NULL)
+	{
+		return arena_alloc((c + 1) * POOL_GRANULE);
+	}
+	free_cells[c] = cell->next;
+	return cell;
+}
+
+void pool_free(void *p, size_t size)
+{
+	if (size > POOL_GRANULE * POOL_CLASSES)
+	{
+		stats.large_frees++;
+		free(p);
+		return;
+	}
+	int c = (size - 1) / POOL_GRANULE;
+	Cell *cell = p;
+	stats.frees[c]++;
+	cell->next = free_cells[c];
+	free_cells[c] = cell;
+}
+
+void print_pool_stats(FILE *f)
+{
+	int c;
+	fputs("vm: allocator   size     allocs      frees       live\n", f);
+	for (c = 0; c < POOL_CLASSES; c++)
+	{
+		fprintf(f, "vm: pool       %5d %10lu %10lu %10lu\n", (c + 1) * POOL_GRANULE,
+			stats.allocs[c], stats.frees[c], stats.allocs[c] - stats.frees[c]);
+	}
+	fprintf(f, "vm: malloc         - %10lu %10lu %10lu\n",
+		stats.large_allocs, stats.large_frees, stats.large_allocs - stats.large_frees);
+	fprintf(f, "vm: arena chunks: %lu (%lu KiB)\n", stats.chunks, stats.chunks * ARENA_CHUNK / 1024);
+}
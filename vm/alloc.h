@@ -0,0 +1,15 @@
+#ifndef ALLOC_DEF
+#define ALLOC_DEF
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Values of up to POOL_GRANULE * POOL_CLASSES bytes come from pools
+#define POOL_GRANULE 16
+#define POOL_CLASSES 8
+
+void* pool_alloc(size_t);
+void pool_free(void*, size_t);
+void print_pool_stats(FILE*);
+
+#endif
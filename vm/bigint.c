@@ -0,0 +1,874 @@
+#include "bigint.h"
+#include "gc.h"
+#include "strings.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+/* Arbitrary precision integers.
+ * The kernels below work on magnitudes: arrays of limbs, which may
+ * have leading zeros. Multiplication is schoolbook below
+ * KARATSUBA_CUTOFF limbs and Karatsuba above it; division is Knuth's
+ * algorithm D. Results are built in a scratch buffer and go through
+ * limbs_to_value, which trims them and turns them into a tagged int
+ * when they fit.
+ */
+
+#define KARATSUBA_CUTOFF 32
+#define LIMB_BASE ((uint64_t)1 << 32)
+
+// a sign and magnitude, of a BigInt or of a tagged int
+typedef struct
+{
+	int sign;
+	int size;
+	const uint32_t *limbs;
+} Digits;
+
+static void get_digits(V v, Digits *d, uint32_t buf[2])
+{
+	long int i;
+	uint64_t m;
+	if (isInt(v))
+	{
+		i = toInt(v);
+		m = i < 0 ? -(uint64_t)i : (uint64_t)i;
+		buf[0] = m;
+		buf[1] = m >> 32;
+		d->sign = i < 0 ? -1 : 1;
+		d->size = buf[1] ? 2 : buf[0] ? 1 : 0;
+		d->limbs = buf;
+	}
+	else
+	{
+		d->sign = toBigInt(v)->sign;
+		d->size = toBigInt(v)->size;
+		d->limbs = toBigInt(v)->limbs;
+	}
+}
+
+static int mag_len(const uint32_t *a, int n)
+{
+	while (n > 0 && a[n - 1] == 0)
+	{
+		n--;
+	}
+	return n;
+}
+
+static int mag_cmp(const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+	int i;
+	an = mag_len(a, an);
+	bn = mag_len(b, bn);
+	if (an != bn)
+	{
+		return an < bn ? -1 : 1;
+	}
+	for (i = an - 1; i >= 0; i--)
+	{
+		if (a[i] != b[i])
+		{
+			return a[i] < b[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+// r = a + b, for an >= bn; r has room for an + 1 limbs
+static void mag_add(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+	uint64_t t = 0;
+	int i;
+	for (i = 0; i < bn; i++)
+	{
+		t += (uint64_t)a[i] + b[i];
+		r[i] = t;
+		t >>= 32;
+	}
+	for (; i < an; i++)
+	{
+		t += a[i];
+		r[i] = t;
+		t >>= 32;
+	}
+	r[an] = t;
+}
+
+// r = a - b, for a >= b and an >= bn; r has an limbs and may be a
+static void mag_sub(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+	int64_t t = 0;
+	int i;
+	for (i = 0; i < bn; i++)
+	{
+		t += (int64_t)a[i] - b[i];
+		r[i] = t;
+		t >>= 32;
+	}
+	for (; i < an; i++)
+	{
+		t += a[i];
+		r[i] = t;
+		t >>= 32;
+	}
+}
+
+// r += b, where r has rn limbs and the sum fits in them
+static void mag_add_into(uint32_t *r, int rn, const uint32_t *b, int bn)
+{
+	uint64_t t = 0;
+	int i;
+	for (i = 0; i < bn; i++)
+	{
+		t += (uint64_t)r[i] + b[i];
+		r[i] = t;
+		t >>= 32;
+	}
+	for (; t && i < rn; i++)
+	{
+		t += r[i];
+		r[i] = t;
+		t >>= 32;
+	}
+}
+
+static void mul_school(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+	uint64_t t;
+	int i, j;
+	memset(r, 0, (an + bn) * sizeof(uint32_t));
+	for (i = 0; i < bn; i++)
+	{
+		t = 0;
+		for (j = 0; j < an; j++)
+		{
+			t += (uint64_t)a[j] * b[i] + r[i + j];
+			r[i + j] = t;
+			t >>= 32;
+		}
+		r[i + an] = t;
+	}
+}
+
+// r = a * b; r has an + bn limbs
+static void mul_mag(uint32_t *r, const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+	const uint32_t *swap;
+	uint32_t *tmp;
+	uint32_t *sa, *sb, *z1;
+	int n, i, m, san, sbn, zn;
+	if (an < bn)
+	{
+		swap = a;
+		a = b;
+		b = swap;
+		n = an;
+		an = bn;
+		bn = n;
+	}
+	if (bn < KARATSUBA_CUTOFF)
+	{
+		mul_school(r, a, an, b, bn);
+		return;
+	}
+	if (2 * bn <= an)
+	{ // lopsided: multiply b by slices of a as long as b
+		memset(r, 0, (an + bn) * sizeof(uint32_t));
+		tmp = malloc(2 * bn * sizeof(uint32_t));
+		for (i = 0; i < an; i += bn)
+		{
+			n = an - i < bn ? an - i : bn;
+			mul_mag(tmp, a + i, n, b, bn);
+			mag_add_into(r + i, an + bn - i, tmp, n + bn);
+		}
+		free(tmp);
+		return;
+	}
+	/* a = a1 B^m + a0, b = b1 B^m + b0
+	 * a b = a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0
+	 * Here bn > m, so b1 is not empty.
+	 */
+	m = an / 2;
+	mul_mag(r, a, m, b, m);
+	mul_mag(r + 2 * m, a + m, an - m, b + m, bn - m);
+	san = an - m + 1;
+	sbn = (bn - m > m ? bn - m : m) + 1;
+	sa = malloc((san + sbn) * sizeof(uint32_t));
+	sb = sa + san;
+	mag_add(sa, a + m, an - m, a, m);
+	if (bn - m >= m)
+	{
+		mag_add(sb, b + m, bn - m, b, m);
+	}
+	else
+	{
+		mag_add(sb, b, m, b + m, bn - m);
+	}
+	zn = san + sbn;
+	z1 = malloc(zn * sizeof(uint32_t));
+	mul_mag(z1, sa, san, sb, sbn);
+	mag_sub(z1, z1, zn, r, 2 * m);
+	mag_sub(z1, z1, zn, r + 2 * m, an + bn - 2 * m);
+	mag_add_into(r + m, an + bn - m, z1, mag_len(z1, zn));
+	free(z1);
+	free(sa);
+}
+
+/* q = u / v and r = u % v, for m >= n >= 1 and v[n - 1] != 0, where q
+ * has m - n + 1 limbs and r has n. This is Knuth's algorithm D, as
+ * given in Hacker's Delight.
+ */
+static void mag_divmod(uint32_t *q, uint32_t *r, const uint32_t *u, int m, const uint32_t *v, int n)
+{
+	uint32_t *un, *vn;
+	uint64_t qhat, rhat, p, k;
+	int64_t t, b;
+	int s, i, j;
+	if (n == 1)
+	{
+		k = 0;
+		for (j = m - 1; j >= 0; j--)
+		{
+			k = (k << 32) | u[j];
+			q[j] = k / v[0];
+			k %= v[0];
+		}
+		r[0] = k;
+		return;
+	}
+	// normalise, so that the top limb of v has its high bit set
+	s = __builtin_clz(v[n - 1]);
+	vn = malloc((n + m + 1) * sizeof(uint32_t));
+	un = vn + n;
+	for (i = n - 1; i > 0; i--)
+	{
+		vn[i] = (v[i] << s) | (uint32_t)((uint64_t)v[i - 1] >> (32 - s));
+	}
+	vn[0] = v[0] << s;
+	un[m] = (uint64_t)u[m - 1] >> (32 - s);
+	for (i = m - 1; i > 0; i--)
+	{
+		un[i] = (u[i] << s) | (uint32_t)((uint64_t)u[i - 1] >> (32 - s));
+	}
+	un[0] = u[0] << s;
+	for (j = m - n; j >= 0; j--)
+	{
+		// estimate the next limb of the quotient, off by at most one
+		p = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+		qhat = p / vn[n - 1];
+		rhat = p % vn[n - 1];
+		while (qhat >= LIMB_BASE || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+		{
+			qhat--;
+			rhat += vn[n - 1];
+			if (rhat >= LIMB_BASE)
+			{
+				break;
+			}
+		}
+		// multiply and subtract
+		b = 0;
+		for (i = 0; i < n; i++)
+		{
+			p = qhat * vn[i];
+			t = un[i + j] - b - (p & 0xFFFFFFFF);
+			un[i + j] = t;
+			b = (p >> 32) - (t >> 32);
+		}
+		t = un[j + n] - b;
+		un[j + n] = t;
+		q[j] = qhat;
+		if (t < 0)
+		{ // subtracted too much, add back
+			q[j]--;
+			k = 0;
+			for (i = 0; i < n; i++)
+			{
+				k += (uint64_t)un[i + j] + vn[i];
+				un[i + j] = k;
+				k >>= 32;
+			}
+			un[j + n] += k;
+		}
+	}
+	for (i = 0; i < n - 1; i++)
+	{
+		r[i] = (un[i] >> s) | (uint32_t)((uint64_t)un[i + 1] << (32 - s));
+	}
+	r[n - 1] = un[n - 1] >> s;
+	free(vn);
+}
+
+// a trimmed magnitude with a sign, as a tagged int if it fits
+V limbs_to_value(int sign, const uint32_t *limbs, uint32_t size)
+{
+	V t;
+	uint64_t m;
+	long int i;
+	size = mag_len(limbs, size);
+	if (size <= 2)
+	{
+		m = size == 0 ? 0 : size == 1 ? limbs[0] : ((uint64_t)limbs[1] << 32) | limbs[0];
+		i = sign < 0 ? -(long int)m : (long int)m;
+		if (m < ((uint64_t)1 << 62) && canBeInt(i))
+		{
+			return intToV(i);
+		}
+	}
+	t = make_new_value(T_BIGINT, true, bigint_bytes(size));
+	toBigInt(t)->sign = sign < 0 ? -1 : 1;
+	toBigInt(t)->size = size;
+	toBigInt(t)->hash = 0;
+	memcpy(toBigInt(t)->limbs, limbs, size * sizeof(uint32_t));
+	return t;
+}
+
+V int128_to_value(frac_long n)
+{
+	unsigned __int128 m = n < 0 ? -(unsigned __int128)n : (unsigned __int128)n;
+	uint32_t limbs[4];
+	int i;
+	if (canBeInt(n))
+	{
+		return intToV((long int)n);
+	}
+	for (i = 0; i < 4; i++)
+	{
+		limbs[i] = m;
+		m >>= 32;
+	}
+	return limbs_to_value(n < 0 ? -1 : 1, limbs, 4);
+}
+
+static V add_digits(Digits *a, Digits *b)
+{
+	Digits *swap;
+	uint32_t *r;
+	V t;
+	int c = 0;
+	if (a->sign != b->sign)
+	{
+		c = mag_cmp(a->limbs, a->size, b->limbs, b->size);
+		if (c == 0)
+		{
+			return intToV(0);
+		}
+	}
+	if (c < 0 || (c == 0 && a->size < b->size))
+	{ // the larger magnitude goes first
+		swap = a;
+		a = b;
+		b = swap;
+	}
+	r = malloc((a->size + 1) * sizeof(uint32_t));
+	if (a->sign == b->sign)
+	{
+		mag_add(r, a->limbs, a->size, b->limbs, b->size);
+		t = limbs_to_value(a->sign, r, a->size + 1);
+	}
+	else
+	{
+		mag_sub(r, a->limbs, a->size, b->limbs, b->size);
+		t = limbs_to_value(a->sign, r, a->size);
+	}
+	free(r);
+	return t;
+}
+
+V bigint_add(V v1, V v2)
+{
+	uint32_t buf1[2], buf2[2];
+	Digits a, b;
+	get_digits(v1, &a, buf1);
+	get_digits(v2, &b, buf2);
+	return add_digits(&a, &b);
+}
+
+V bigint_sub(V v1, V v2)
+{
+	uint32_t buf1[2], buf2[2];
+	Digits a, b;
+	get_digits(v1, &a, buf1);
+	get_digits(v2, &b, buf2);
+	b.sign = -b.sign;
+	return add_digits(&a, &b);
+}
+
+V bigint_mul(V v1, V v2)
+{
+	uint32_t buf1[2], buf2[2];
+	uint32_t *r;
+	Digits a, b;
+	V t;
+	get_digits(v1, &a, buf1);
+	get_digits(v2, &b, buf2);
+	if (a.size == 0 || b.size == 0)
+	{
+		return intToV(0);
+	}
+	r = malloc((a.size + b.size) * sizeof(uint32_t));
+	mul_mag(r, a.limbs, a.size, b.limbs, b.size);
+	t = limbs_to_value(a.sign * b.sign, r, a.size + b.size);
+	free(r);
+	return t;
+}
+
+// the truncated quotient and the remainder of two integers, for v2 != 0
+static void divmod(V v1, V v2, V *quotient, V *remainder)
+{
+	uint32_t buf1[2], buf2[2];
+	uint32_t *q, *r;
+	Digits a, b;
+	get_digits(v1, &a, buf1);
+	get_digits(v2, &b, buf2);
+	if (mag_cmp(a.limbs, a.size, b.limbs, b.size) < 0)
+	{
+		*quotient = intToV(0);
+		*remainder = add_ref(v1);
+		return;
+	}
+	q = malloc((a.size + 1) * sizeof(uint32_t));
+	r = q + a.size - b.size + 1;
+	mag_divmod(q, r, a.limbs, a.size, b.limbs, b.size);
+	*quotient = limbs_to_value(a.sign * b.sign, q, a.size - b.size + 1);
+	*remainder = limbs_to_value(a.sign, r, b.size);
+	free(q);
+}
+
+// the exact quotient if there is one, a double otherwise
+V bigint_div(V v1, V v2)
+{
+	V q, r;
+	divmod(v1, v2, &q, &r);
+	if (r == intToV(0))
+	{
+		return q;
+	}
+	clear_ref(q);
+	clear_ref(r);
+	return double_to_value(bigint_to_double(v1) / bigint_to_double(v2));
+}
+
+// the remainder has the sign of v1, like fmod
+V bigint_mod(V v1, V v2)
+{
+	V q, r;
+	divmod(v1, v2, &q, &r);
+	clear_ref(q);
+	return r;
+}
+
+int bigint_cmp(V v1, V v2)
+{
+	uint32_t buf1[2], buf2[2];
+	Digits a, b;
+	int c;
+	get_digits(v1, &a, buf1);
+	get_digits(v2, &b, buf2);
+	if (a.size == 0 && b.size == 0)
+	{
+		return 0;
+	}
+	if (a.size == 0 || b.size == 0 || a.sign != b.sign)
+	{
+		return a.size == 0 ? -b.sign : a.sign;
+	}
+	c = mag_cmp(a.limbs, a.size, b.limbs, b.size);
+	return a.sign < 0 ? -c : c;
+}
+
+V bigint_neg(V v)
+{
+	uint32_t buf[2];
+	Digits a;
+	get_digits(v, &a, buf);
+	return limbs_to_value(-a.sign, a.limbs, a.size);
+}
+
+bool bigint_equal(V v1, V v2)
+{
+	BigInt *a = toBigInt(v1);
+	BigInt *b = toBigInt(v2);
+	return a->sign == b->sign && a->size == b->size &&
+		!memcmp(a->limbs, b->limbs, a->size * sizeof(uint32_t));
+}
+
+double bigint_to_double(V v)
+{
+	uint32_t buf[2];
+	Digits a;
+	double x = 0.0;
+	int i;
+	get_digits(v, &a, buf);
+	for (i = a.size - 1; i >= 0; i--)
+	{
+		x = x * (double)LIMB_BASE + a.limbs[i];
+	}
+	return a.sign * x;
+}
+
+// the decimal digits, in a string the caller frees
+char *bigint_to_str(V v)
+{
+	uint32_t buf[2];
+	uint32_t *m;
+	uint64_t k;
+	Digits a;
+	char *s, *p;
+	int n, i;
+	get_digits(v, &a, buf);
+	// each limb gives less than 10 digits
+	s = malloc(a.size * 10 + 3);
+	p = s + a.size * 10 + 2;
+	*p = '\0';
+	m = malloc((a.size + 1) * sizeof(uint32_t));
+	memcpy(m, a.limbs, a.size * sizeof(uint32_t));
+	n = a.size;
+	do
+	{ // divide by 10^9, giving 9 digits at a time
+		k = 0;
+		for (i = n - 1; i >= 0; i--)
+		{
+			k = (k << 32) | m[i];
+			m[i] = k / 1000000000;
+			k %= 1000000000;
+		}
+		n = mag_len(m, n);
+		for (i = 0; i < 9 && (n > 0 || k > 0 || i == 0); i++)
+		{
+			*--p = '0' + k % 10;
+			k /= 10;
+		}
+	}
+	while (n > 0);
+	if (a.sign < 0)
+	{
+		*--p = '-';
+	}
+	memmove(s, p, strlen(p) + 1);
+	free(m);
+	return s;
+}
+
+uint32_t bigint_hash(V v)
+{
+	BigInt *b = toBigInt(v);
+	if (b->hash == 0)
+	{
+		b->hash = new_string_hash(b->size * sizeof(uint32_t), (const char*)b->limbs) ^ (b->sign < 0);
+	}
+	return b->hash;
+}
+
+// decimal digits with an optional minus sign, or NULL for other text
+V str_to_bigint(const char *s)
+{
+	uint32_t *m;
+	uint64_t k;
+	uint32_t chunk, scale;
+	size_t len, i;
+	int sign = 1;
+	int n = 0;
+	int j;
+	V t;
+	if (*s == '-')
+	{
+		sign = -1;
+		s++;
+	}
+	len = strlen(s);
+	if (len == 0)
+	{
+		return NULL;
+	}
+	for (i = 0; i < len; i++)
+	{
+		if (s[i] < '0' || s[i] > '9')
+		{
+			return NULL;
+		}
+	}
+	// every 9 digits fit in a limb
+	m = malloc((len / 9 + 1) * sizeof(uint32_t));
+	for (i = 0; i < len; )
+	{ // multiply by 10^9 and add the next 9 digits, the first time fewer
+		chunk = 0;
+		scale = 1;
+		do
+		{
+			chunk = chunk * 10 + (s[i++] - '0');
+			scale *= 10;
+		}
+		while (i < len && (len - i) % 9 != 0);
+		k = chunk;
+		for (j = 0; j < n; j++)
+		{
+			k += (uint64_t)m[j] * scale;
+			m[j] = k;
+			k >>= 32;
+		}
+		if (k)
+		{
+			m[n++] = k;
+		}
+	}
+	t = limbs_to_value(sign, m, n);
+	free(m);
+	return t;
+}
+
+/* Exact rationals.
+ * Whenever a BigInt or a BigFrac is involved, fractions are taken
+ * apart into integers, and the arithmetic is done on those with the
+ * functions above. ratio_to_value reduces the result and picks its
+ * representation. This is slow, but it only runs once the parts have
+ * outgrown a long.
+ */
+
+// the numerator and the denominator of a rational, as new references
+static void get_parts(V v, V *n, V *d)
+{
+	if (isInteger(v))
+	{
+		*n = add_ref(v);
+		*d = intToV(1);
+	}
+	else if (getType(v) == T_BIGFRAC)
+	{
+		*n = add_ref(toBigFrac(v)->numerator);
+		*d = add_ref(toBigFrac(v)->denominator);
+	}
+	else
+	{
+		*n = int128_to_value(getNumer(v));
+		*d = int128_to_value(getDenom(v));
+	}
+}
+
+static V integer_abs(V v)
+{
+	return bigint_cmp(v, intToV(0)) < 0 ? bigint_neg(v) : add_ref(v);
+}
+
+static V integer_gcd(V v1, V v2)
+{
+	V a = integer_abs(v1);
+	V b = integer_abs(v2);
+	V t;
+	while (b != intToV(0))
+	{
+		t = bigint_mod(a, b);
+		clear_ref(a);
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static bool fits_long(V v, long int *x)
+{
+	BigInt *b;
+	uint64_t m;
+	if (isInt(v))
+	{
+		*x = toInt(v);
+		return true;
+	}
+	b = toBigInt(v);
+	if (b->size != 2)
+	{
+		return false;
+	}
+	m = ((uint64_t)b->limbs[1] << 32) | b->limbs[0];
+	if (m > (uint64_t)LONG_MAX + (b->sign < 0))
+	{
+		return false;
+	}
+	*x = b->sign < 0 ? (long int)-m : (long int)m;
+	return true;
+}
+
+// takes over the references to n and d, which must already be reduced
+V new_bigfrac(V n, V d)
+{
+	V t = make_new_value(T_BIGFRAC, true, sizeof(BigFrac));
+	toBigFrac(t)->numerator = n;
+	toBigFrac(t)->denominator = d;
+	return t;
+}
+
+// n / d for two integers, with d != 0
+V ratio_to_value(V n, V d)
+{
+	V g, t;
+	long int a, b;
+	if (bigint_cmp(d, intToV(0)) < 0)
+	{
+		n = bigint_neg(n);
+		d = bigint_neg(d);
+	}
+	else
+	{
+		n = add_ref(n);
+		d = add_ref(d);
+	}
+	g = integer_gcd(n, d);
+	if (g != intToV(1))
+	{ // these divisions are exact
+		t = bigint_div(n, g);
+		clear_ref(n);
+		n = t;
+		t = bigint_div(d, g);
+		clear_ref(d);
+		d = t;
+	}
+	clear_ref(g);
+	if (d == intToV(1))
+	{
+		return n;
+	}
+	if (fits_long(n, &a) && fits_long(d, &b))
+	{
+		clear_ref(n);
+		clear_ref(d);
+		return new_frac(a, b);
+	}
+	return new_bigfrac(n, d);
+}
+
+// ((n1 * d2) op (n2 * d1)) / (d1 * d2)
+static V cross_ratio(V v1, V v2, V (*op)(V, V))
+{
+	V n1, d1, n2, d2, a, b, n, d, r;
+	get_parts(v1, &n1, &d1);
+	get_parts(v2, &n2, &d2);
+	a = bigint_mul(n1, d2);
+	b = bigint_mul(n2, d1);
+	n = op(a, b);
+	d = bigint_mul(d1, d2);
+	r = ratio_to_value(n, d);
+	clear_ref(n1);
+	clear_ref(d1);
+	clear_ref(n2);
+	clear_ref(d2);
+	clear_ref(a);
+	clear_ref(b);
+	clear_ref(n);
+	clear_ref(d);
+	return r;
+}
+
+V rational_add(V v1, V v2)
+{
+	if (isInteger(v1) && isInteger(v2))
+	{
+		return bigint_add(v1, v2);
+	}
+	return cross_ratio(v1, v2, bigint_add);
+}
+
+V rational_sub(V v1, V v2)
+{
+	if (isInteger(v1) && isInteger(v2))
+	{
+		return bigint_sub(v1, v2);
+	}
+	return cross_ratio(v1, v2, bigint_sub);
+}
+
+// the remainder has the sign of v1, as for Fracs
+V rational_mod(V v1, V v2)
+{
+	if (isInteger(v1) && isInteger(v2))
+	{
+		return bigint_mod(v1, v2);
+	}
+	return cross_ratio(v1, v2, bigint_mod);
+}
+
+// (n1 * n2) / (d1 * d2), or with the parts of v2 swapped for division
+static V mul_ratio(V v1, V v2, bool invert)
+{
+	V n1, d1, n2, d2, n, d, r;
+	get_parts(v1, &n1, &d1);
+	get_parts(v2, invert ? &d2 : &n2, invert ? &n2 : &d2);
+	n = bigint_mul(n1, n2);
+	d = bigint_mul(d1, d2);
+	r = ratio_to_value(n, d);
+	clear_ref(n1);
+	clear_ref(d1);
+	clear_ref(n2);
+	clear_ref(d2);
+	clear_ref(n);
+	clear_ref(d);
+	return r;
+}
+
+V rational_mul(V v1, V v2)
+{
+	if (isInteger(v1) && isInteger(v2))
+	{
+		return bigint_mul(v1, v2);
+	}
+	return mul_ratio(v1, v2, false);
+}
+
+// exact even for two integers, unlike bigint_div; for v2 != 0
+V rational_div(V v1, V v2)
+{
+	return mul_ratio(v1, v2, true);
+}
+
+int rational_cmp(V v1, V v2)
+{
+	V n1, d1, n2, d2, a, b;
+	int c;
+	if (isInteger(v1) && isInteger(v2))
+	{
+		return bigint_cmp(v1, v2);
+	}
+	get_parts(v1, &n1, &d1);
+	get_parts(v2, &n2, &d2);
+	a = bigint_mul(n1, d2);
+	b = bigint_mul(n2, d1);
+	c = bigint_cmp(a, b);
+	clear_ref(n1);
+	clear_ref(d1);
+	clear_ref(n2);
+	clear_ref(d2);
+	clear_ref(a);
+	clear_ref(b);
+	return c;
+}
+
+// the top three limbs as a double, times 2 ^ *e
+static double top_limbs(V v, int *e)
+{
+	uint32_t buf[2];
+	Digits a;
+	double x = 0.0;
+	int i;
+	get_digits(v, &a, buf);
+	for (i = a.size - 1; i >= 0 && i >= a.size - 3; i--)
+	{
+		x = x * (double)LIMB_BASE + a.limbs[i];
+	}
+	*e = 32 * (i + 1);
+	return a.sign * x;
+}
+
+// the parts are scaled first, as either can be too large for a double
+double rational_to_double(V v)
+{
+	V n, d;
+	int e1, e2;
+	double x;
+	get_parts(v, &n, &d);
+	x = top_limbs(n, &e1) / top_limbs(d, &e2);
+	clear_ref(n);
+	clear_ref(d);
+	return ldexp(x, e1 - e2);
+}
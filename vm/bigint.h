@@ -0,0 +1,71 @@
+#ifndef BIGINT_DEF
+#define BIGINT_DEF
+
+#include <stddef.h>
+
+#include "value.h"
+#include "types.h"
+
+/* Integers too large for a tagged int.
+ * The magnitude is kept in 32 bit limbs, least significant first,
+ * without leading zeros. Every operation gives a tagged int back when
+ * the result fits in one, so a BigInt never equals a tagged int.
+ */
+typedef struct
+{
+	int32_t sign; // 1 or -1
+	uint32_t size;
+	uint32_t hash; // 0 until bigint_hash needs it
+	uint32_t limbs[1]; // Really size limbs long.
+} BigInt;
+
+/* Fractions with a part too large for a long.
+ * The parts are integers, tagged or BigInt, without a common factor,
+ * and the denominator is positive. A fraction whose parts both fit in
+ * a long is always a Frac instead, so equal fractions have the same
+ * type.
+ */
+typedef struct
+{
+	V numerator;
+	V denominator;
+} BigFrac;
+
+#define toBigInt(x) ((BigInt*)(x + 1))
+#define toBigFrac(x) ((BigFrac*)(x + 1))
+#define bigint_bytes(n) (offsetof(BigInt, limbs) + (n) * sizeof(uint32_t))
+#define isInteger(x) (isInt(x) || getType(x) == T_BIGINT)
+#define isRational(x) (isInteger(x) || getType(x) == T_FRAC || getType(x) == T_BIGFRAC)
+
+V limbs_to_value(int, const uint32_t*, uint32_t);
+V int128_to_value(frac_long);
+
+// these take two integers, tagged or not
+V bigint_add(V, V);
+V bigint_sub(V, V);
+V bigint_mul(V, V);
+V bigint_div(V, V);
+V bigint_mod(V, V);
+int bigint_cmp(V, V);
+
+V bigint_neg(V);
+bool bigint_equal(V, V);
+double bigint_to_double(V);
+char *bigint_to_str(V);
+V str_to_bigint(const char*);
+uint32_t bigint_hash(V);
+
+V new_bigfrac(V, V);
+V ratio_to_value(V, V);
+
+// these take two integers or fractions
+V rational_add(V, V);
+V rational_sub(V, V);
+V rational_mul(V, V);
+V rational_div(V, V);
+V rational_mod(V, V);
+int rational_cmp(V, V);
+
+double rational_to_double(V);
+
+#endif
@@ -84,6 +84,10 @@ void handle_error(Error e, Stack *scope_arr)
 	for (n = 0; n < scope_arr->used; n++)
 	{
 		sc = toScope(scope_arr->nodes[n]);
+		if (sc->is_tail_call)
+		{
+			fputs("(...tail calls...)\n", stderr);
+		}
 		if (show_next)
 		{
 			NewString *s = toFile(sc->file)->source != NULL ? toNewString(toFile(sc->file)->source) : toNewString(toFile(sc->file)->name);
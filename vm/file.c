@@ -1,5 +1,8 @@
 #include "file.h"
 #include "strings.h"
+#include "opcodes.h"
+#include "scope.h"
+#include "verify.h"
 #include <assert.h>
 
 V load_file(V file_name, V global)
@@ -60,6 +63,282 @@ V load_stdin(V global)
 	return obj;
 }
 
+static bool looks_up_names(uint32_t opcode)
+{
+	return opcode == OP_PUSH_WORD || opcode == OP_TAILCALL || opcode == OP_GET || opcode == OP_CALL ||
+		(opcode >= OP_ADD && opcode <= OP_EQ) ||
+		(opcode >= OP_LT_JMPZ && opcode <= OP_EQ_JMPZ);
+}
+
+static uint32_t unslotted(uint32_t opcode)
+{
+	switch (opcode)
+	{
+		case OP_PUSH_SLOT:
+			return OP_PUSH_WORD;
+		case OP_SET_SLOT:
+			return OP_SET;
+		case OP_SET_LOCAL_SLOT:
+			return OP_SET_LOCAL;
+		case OP_GET_SLOT:
+			return OP_GET;
+	}
+	return opcode;
+}
+
+// Collects the slot names of the function body [start, end),
+// giving nested functions frames of their own.
+// A function that creates functions with LABDA lets its scope escape;
+// FLAT_LABDA only copies values out of it.
+static void decode_frame(Instruction *code, uint32_t start, uint32_t end, Frame *frame, Frame **next_frame)
+{
+	V names[256];
+	int n_slots = 0;
+	uint32_t i;
+	uint32_t body_end;
+	for (i = start; i < end; i++)
+	{
+		switch (code[i].opcode)
+		{
+			case OP_LABDA:
+				if (frame != NULL)
+				{
+					frame->escapes = true;
+				}
+			case OP_FLAT_LABDA:
+				code[i].frame = (*next_frame)++;
+				body_end = i + code[i].arg;
+				if (body_end > end || body_end <= i)
+				{
+					body_end = end;
+				}
+				decode_frame(code, i + 1, body_end, code[i].frame, next_frame);
+				i = body_end - 1;
+				break;
+			case OP_PUSH_SLOT:
+			case OP_SET_SLOT:
+			case OP_SET_LOCAL_SLOT:
+			case OP_GET_SLOT:
+				if (frame == NULL || code[i].literal == NULL || getType(code[i].literal) != T_IDENT)
+				{ // slots only exist inside functions
+					code[i].opcode = unslotted(code[i].opcode);
+					break;
+				}
+				while (n_slots <= code[i].arg)
+				{
+					names[n_slots++] = NULL;
+				}
+				names[code[i].arg] = code[i].literal;
+				// caches must never see through a slot
+				toIdent(code[i].literal)->bound_locally = true;
+				break;
+		}
+	}
+	if (frame != NULL)
+	{
+		frame->n_slots = n_slots;
+		frame->names = malloc(n_slots * sizeof(V));
+		memcpy(frame->names, names, n_slots * sizeof(V));
+	}
+}
+
+/* Exception handling.
+ * A try costs nothing until something goes wrong: ENTER_ERRHAND only
+ * jumps over the handler to the body, which ends at its LEAVE_ERRHAND.
+ * The bodies are collected here, leaving out functions created in
+ * them, as those do not run in the try. When an error is raised, run()
+ * looks up the pc of every scope in this table, from the top of the
+ * scope stack down.
+ */
+static void add_handler(File *f, int *capacity, uint32_t start, uint32_t end, uint32_t handler)
+{
+	if (start >= end)
+	{
+		return;
+	}
+	if (f->n_handlers == *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 8;
+		f->handlers = realloc(f->handlers, *capacity * sizeof(Handler));
+	}
+	f->handlers[f->n_handlers++] = (Handler){f->code + start, f->code + end, f->code + handler};
+}
+
+static int compare_handlers(const void *a, const void *b)
+{
+	const Handler *x = a;
+	const Handler *y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static void decode_handlers(File *f, uint32_t size)
+{
+	Instruction *code = f->code;
+	int capacity = 0;
+	int depth;
+	uint32_t i;
+	uint32_t j;
+	uint32_t start;
+	f->handlers = NULL;
+	f->n_handlers = 0;
+	for (i = 0; i < size; i++)
+	{
+		if (code[i].opcode != OP_ENTER_ERRHAND || i + code[i].arg >= size)
+		{
+			continue;
+		}
+		depth = 0;
+		start = i + code[i].arg;
+		for (j = start; j < size; j++)
+		{
+			if (code[j].opcode == OP_LABDA || code[j].opcode == OP_FLAT_LABDA)
+			{
+				if (code[j].arg <= 0 || j + code[j].arg > size)
+				{
+					break;
+				}
+				add_handler(f, &capacity, start, j + 1, i);
+				start = j + code[j].arg;
+				j = start - 1;
+			}
+			else if (code[j].opcode == OP_ENTER_ERRHAND)
+			{
+				depth++;
+			}
+			else if (code[j].opcode == OP_LEAVE_ERRHAND)
+			{
+				if (depth == 0)
+				{
+					break;
+				}
+				depth--;
+			}
+		}
+		add_handler(f, &capacity, start, j, i);
+	}
+	if (f->n_handlers > 1)
+	{
+		qsort(f->handlers, f->n_handlers, sizeof(Handler), compare_handlers);
+	}
+}
+
+// the innermost try body around pc in file, if any
+Handler *find_handler(V file, Instruction *pc)
+{
+	File *f = toFile(file);
+	int lo = 0;
+	int hi = f->n_handlers;
+	int mid;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (f->handlers[mid].start <= pc)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	// bodies nest, so the last one that contains pc is the innermost
+	while (--lo >= 0)
+	{
+		if (f->handlers[lo].end > pc)
+		{
+			return &f->handlers[lo];
+		}
+	}
+	return NULL;
+}
+
+static void decode_code(char *data, Header *h, File *f)
+{
+	Instruction *code = malloc(h->size * sizeof(Instruction));
+	uint32_t i;
+	uint32_t word;
+	int n_caches = 0;
+	Frame *next_frame;
+	f->n_frames = 0;
+	for (i = 0; i < h->size; i++)
+	{
+		memcpy(&word, data + 4 * i, 4);
+		word = ntohl(word);
+		code[i].opcode = word >> 24;
+		code[i].arg = word & 16777215;
+		code[i].literal = NULL;
+		code[i].cache = NULL;
+		switch (code[i].opcode)
+		{
+			case OP_PUSH_INTEGER:
+			case OP_JMP:
+			case OP_JMPZ:
+			case OP_JMPEQ:
+			case OP_JMPNE:
+				code[i].arg = ((int32_t)(word << 8)) >> 8;
+				break;
+			case OP_PUSH_LITERAL:
+			case OP_PUSH_WORD:
+			case OP_TAILCALL:
+			case OP_SET:
+			case OP_SET_LOCAL:
+			case OP_SET_GLOBAL:
+			case OP_GET:
+			case OP_GET_GLOBAL:
+			case OP_SOURCE_FILE:
+			case OP_CAPTURE:
+			case OP_ADD:
+			case OP_SUB:
+			case OP_MUL:
+			case OP_LT:
+			case OP_GT:
+			case OP_LE:
+			case OP_GE:
+			case OP_EQ:
+			case OP_LT_JMPZ:
+			case OP_GT_JMPZ:
+			case OP_LE_JMPZ:
+			case OP_GE_JMPZ:
+			case OP_EQ_JMPZ:
+				code[i].literal = get_literal(h, code[i].arg);
+				break;
+			case OP_PUSH_SLOT:
+			case OP_SET_SLOT:
+			case OP_SET_LOCAL_SLOT:
+			case OP_GET_SLOT:
+				// the argument is the literal index followed by 8 bits of slot index
+				code[i].literal = get_literal(h, code[i].arg >> 8);
+				code[i].arg &= 255;
+				break;
+			case OP_LABDA:
+			case OP_FLAT_LABDA:
+				f->n_frames++;
+				break;
+		}
+	}
+	f->code = code;
+	f->frames = calloc(f->n_frames, sizeof(Frame));
+	next_frame = f->frames;
+	decode_frame(code, 0, h->size, NULL, &next_frame);
+	decode_handlers(f, h->size);
+	binding_version++;
+	for (i = 0; i < h->size; i++)
+	{
+		if (looks_up_names(code[i].opcode))
+		{
+			n_caches++;
+		}
+	}
+	f->caches = calloc(n_caches, sizeof(InlineCache));
+	for (i = 0; i < h->size; i++)
+	{
+		if (looks_up_names(code[i].opcode))
+		{
+			code[i].cache = &f->caches[--n_caches];
+		}
+	}
+}
+
 V load_memfile(char *data, size_t length, V file_name, V global)
 {
 	V new_file = NULL;
@@ -77,9 +356,13 @@ V load_memfile(char *data, size_t length, V file_name, V global)
 		f_obj->source = NULL;
 		f_obj->header = h;
 		f_obj->global = global;
-		uint32_t *code = malloc(h.size * 4);
-		memcpy(code, data, 4 * h.size);
-		f_obj->code = code;
+		decode_code(data, &h, f_obj);
+		if (!verify_code(f_obj->code, h.size))
+		{
+			clear_ref(new_file);
+			error_msg = "malformed Déjà Vu bytecode";
+			return NULL;
+		}
 	}
 	else
 		error_msg = "not a valid Déjà Vu bytecode file";
@@ -4,21 +4,36 @@
 #include "literals.h"
 #include "types.h"
 #include "gc.h"
+#include "instruction.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
+// the try body [start, end) is handled by the code after handler
+typedef struct
+{
+	Instruction *start;
+	Instruction *end;
+	Instruction *handler;
+} Handler;
+
 typedef struct
 {
 	V name;
 	V source;
 	V global;
 	Header header;
-	uint32_t *code;
+	Instruction *code;
+	InlineCache *caches;
+	Frame *frames;
+	int n_frames;
+	Handler *handlers; //sorted by start
+	int n_handlers;
 } File;
 
 V load_file(V, V);
 V load_stdin(V);
 V load_memfile(char*, size_t, V, V);
+Handler *find_handler(V, Instruction*);
 
 #endif
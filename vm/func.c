@@ -2,7 +2,7 @@
 #include "types.h"
 #include "gc.h"
 
-V new_func(V scope, uint32_t *pc)
+V new_func(V scope, Instruction *pc)
 {
 	V v = make_new_value(T_FUNC, false, sizeof(Func));
 	Func *f = toFunc(v);
@@ -2,15 +2,16 @@
 #define FUNC_DEF
 
 #include "value.h"
+#include "instruction.h"
 
 #include <stdint.h>
 
 typedef struct Func
 {
 	V defscope;
-	uint32_t *start;
+	Instruction *start;
 } Func;
 
-V new_func(V, uint32_t*);
+V new_func(V, Instruction*);
 
 #endif
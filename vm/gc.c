@@ -3,17 +3,47 @@
 #include "func.h"
 #include "file.h"
 #include "debug.h"
+#include "alloc.h"
+#include "jit.h"
+#include "strings.h"
+#include "bigint.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include <assert.h>
 
-#define MAX_ROOTS 1024
+/* Candidate roots of garbage cycles are buffered until there are
+ * gc_root_limit of them. With gc_slice set to 0 the whole buffer is
+ * then collected at once. Otherwise the collection is left to the run
+ * loop, which calls collect_slice between calls and returns; every
+ * slice handles the gc_slice oldest candidates, until the buffer is
+ * empty. Trial deletion only finds garbage, whatever subset of the
+ * candidates it starts from, but a cycle can be collected through a
+ * candidate in an earlier slice than another of its members. That
+ * member is left Black without references and still buffered, and is
+ * freed once its own slot is reached.
+ * The buffer grows when the run loop does not get to it in time, up
+ * to MAX_BACKLOG times the limit, where everything is collected.
+ * Nothing is collected while release_value is clearing the children of
+ * a value: that value can be a candidate, and the collector would free
+ * it from under release_value.
+ */
+#define MAX_BACKLOG 16
+
+int gc_root_limit = 1024;
+int gc_slice = 0;
+bool gc_pending = false;
+
+GCStats gc_stats;
 
 static int root_size = 0;
-static V roots[MAX_ROOTS];
+static int root_capacity = 0;
+static V* roots = NULL;
+static int releasing = 0; // how deep release_value is nested
 
 extern bool vm_debug;
 
@@ -21,7 +51,8 @@ void collect_cycles(void);
 
 V make_new_value(int type, bool simple, int size)
 {
-	V t = malloc(sizeof(Value) + size);
+	V t = pool_alloc(sizeof(Value) + size);
+	count_new_value(type, size);
 	t->buffered = false;
 	t->type = type;
 	t->refs = 1;
@@ -30,9 +61,19 @@ V make_new_value(int type, bool simple, int size)
 	return t;
 }
 
+void count_new_value(int type, size_t size)
+{
+	gc_stats.allocs[type]++;
+	gc_stats.live_bytes += sizeof(Value) + size;
+	if (gc_stats.live_bytes > gc_stats.peak_bytes)
+	{
+		gc_stats.peak_bytes = gc_stats.live_bytes;
+	}
+}
+
 V add_ref(V t)
 {
-	if (isInt(t) || t->type == T_IDENT)
+	if (!isPointer(t) || t->type == T_IDENT)
 		return t;
 
 	t->refs++;
@@ -45,7 +86,7 @@ V add_ref(V t)
 
 V add_base_ref(V t)
 {
-	if (isInt(t) || t->type == T_IDENT)
+	if (!isPointer(t) || t->type == T_IDENT)
 		return t;
 
 	t->baserefs++;
@@ -55,7 +96,7 @@ V add_base_ref(V t)
 
 V add_rooted(V t)
 {
-	if (isInt(t) || t->type == T_IDENT)
+	if (!isPointer(t) || t->type == T_IDENT)
 		return t;
 
 	t->baserefs++;
@@ -63,14 +104,46 @@ V add_rooted(V t)
 	return t;
 }
 
+// the size make_new_value was called with
+static size_t value_size(V t)
+{
+	switch (getType(t))
+	{
+		case T_STR:
+			return sizeof(NewString) + toNewString(t)->size;
+		case T_NUM:
+			return sizeof(double);
+		case T_LIST:
+			return sizeof(Stack);
+		case T_DICT:
+			return sizeof(HashMap);
+		case T_PAIR:
+			return sizeof(V) * 2 + sizeof(uint32_t);
+		case T_FRAC:
+			return sizeof(Frac);
+		case T_BIGINT:
+			return bigint_bytes(toBigInt(t)->size);
+		case T_BIGFRAC:
+			return sizeof(BigFrac);
+		case T_FUNC:
+			return sizeof(Func);
+		case T_SCOPE:
+			return sizeof(Scope);
+		case T_FILE:
+			return sizeof(File);
+		case T_CFUNC:
+			return sizeof(CFuncP);
+	}
+	return 0;
+}
+
 void free_value(V t)
 {
-	Scope* sc;
-	Bucket* b;
-	Bucket* bb;
 	File* f;
-	HashMap* hm;
 	int n;
+	size_t size = value_size(t);
+	gc_stats.frees[t->type]++;
+	gc_stats.live_bytes -= sizeof(Value) + size;
 	switch (getType(t))
 	{
 		case T_STR:
@@ -81,69 +154,31 @@ void free_value(V t)
 			free(toStack(t)->nodes);
 			break;
 		case T_DICT:
-			hm = toHashMap(t);
-			if (hm->map != NULL)
-			{
-				for (n = 0; n < hm->size; n++)
-				{
-					b = hm->map[n];
-					while(b != NULL)
-					{
-						bb = b;
-						b = b->next;
-						free(bb);
-					}
-				}
-				free(hm->map);
-			}
+			free(toHashMap(t)->map);
 			break;
 		case T_SCOPE:
-			sc = toScope(t);
-			if (sc->hm.map != NULL)
-			{
-				for (n = 0; n < sc->hm.size; n++)
-				{
-					b = sc->hm.map[n];
-					while(b != NULL)
-					{
-						bb = b;
-						b = b->next;
-						free(bb);
-					}
-				}
-				free(sc->hm.map);
-			}
-			if (sc->index > 0)
-			{
-				if (MAXSCOPE == sc->index)
-				{
-					sc->index = 0;
-					while (SCOPECACHE[--MAXSCOPE].sc.index == 0)
-					{
-						if (MAXSCOPE == 0)
-						{
-							MAXSCOPE--;
-							break;
-						}
-					}
-					MAXSCOPE++;
-				}
-				sc->index = 0;
-				return;
-			}
-			break;
+			recycle_scope(t);
+			return;
 		case T_FILE:
 			f = toFile(t);
 			free(f->header.literals);
 			free(f->code);
+			free(f->caches);
+			for (n = 0; n < f->n_frames; n++)
+			{
+				free(f->frames[n].names);
+				jit_free(&f->frames[n]);
+			}
+			free(f->frames);
+			free(f->handlers);
 			break;
 	}
-	free(t);
+	pool_free(t, sizeof(Value) + size);
 }
 
 void iter_children(V t, void (*iter)(V))
 {
-	if (isInt(t) || t->type == T_IDENT)
+	if (!isPointer(t) || t->type == T_IDENT)
 		return;
 
 	Stack* s;
@@ -175,12 +210,11 @@ void iter_children(V t, void (*iter)(V))
 			{
 				for (i = 0; i < hm->size; i++)
 				{
-					b = hm->map[i];
-					while(b != NULL)
+					b = &hm->map[i];
+					if (b->key != NULL)
 					{
 						iter(b->key);
 						iter(b->value);
-						b = b->next;
 					}
 				}
 			}
@@ -189,26 +223,39 @@ void iter_children(V t, void (*iter)(V))
 			iter(toFirst(t));
 			iter(toSecond(t));
 			break;
+		case T_BIGFRAC:
+			iter(toBigFrac(t)->numerator);
+			iter(toBigFrac(t)->denominator);
+			break;
 		case T_SCOPE:
 			sc = toScope(t);
-			if (sc->parent && toScope(sc->parent)->parent)
-			{ // do not iterate over the global scope, as it cannot be collected
-				iter(sc->parent);
+			if (sc->is_func_scope || !on_frame_stack(t))
+			{ // block scopes on the frame stack borrow these, see new_scope
+				if (sc->parent && toScope(sc->parent)->parent)
+				{ // do not iterate over the global scope, as it cannot be collected
+					iter(sc->parent);
+				}
+				if (sc->func)
+				{
+					iter(sc->func);
+				}
 			}
-			if (sc->func)
+			for (i = 0; i < sc->n_slots; i++)
 			{
-				iter(sc->func);
+				if (sc->slots[i] != NULL)
+				{
+					iter(sc->slots[i]);
+				}
 			}
 			if (sc->hm.map != NULL)
 			{
 				for (i = 0; i < sc->hm.size; i++)
 				{
-					b = sc->hm.map[i];
-					while(b != NULL)
+					b = &sc->hm.map[i];
+					if (b->key != NULL)
 					{
 						iter(b->key);
 						iter(b->value);
-						b = b->next;
 					}
 				}
 			}
@@ -224,14 +271,32 @@ void iter_children(V t, void (*iter)(V))
 	}
 }
 
+static void buffer_full(void)
+{
+	if (gc_slice <= 0 || root_size >= gc_root_limit * MAX_BACKLOG)
+	{
+		collect_cycles();
+	}
+	else
+	{
+		gc_pending = true;
+	}
+}
+
 void release_value(V t)
 {
+	releasing++;
 	iter_children(t, clear_ref);
+	releasing--;
 	t->color = Black;
 	if (!t->buffered)
 	{
 		free_value(t);
 	}
+	if (releasing == 0 && root_size >= gc_root_limit)
+	{
+		buffer_full();
+	}
 }
 
 void possible_root(V t)
@@ -242,10 +307,16 @@ void possible_root(V t)
 		if (!t->buffered)
 		{
 			t->buffered = true;
+			if (root_size == root_capacity)
+			{
+				root_capacity = root_capacity ? root_capacity * 2 : gc_root_limit;
+				roots = realloc(roots, root_capacity * sizeof(V));
+			}
 			roots[root_size++] = t;
-			if (root_size >= MAX_ROOTS)
+			gc_stats.roots_buffered++;
+			if (root_size >= gc_root_limit && releasing == 0)
 			{
-				collect_cycles();
+				buffer_full();
 			}
 		}
 	}
@@ -255,7 +326,7 @@ void mark_gray(V);
 
 void mark_gray_child(V child)
 {
-	if (isInt(child) || child->type == T_IDENT)
+	if (!isPointer(child) || child->type == T_IDENT)
 		return;
 
 	if (child != NULL)
@@ -274,11 +345,11 @@ void mark_gray(V t)
 	}
 }
 
-void mark_roots(void)
+void mark_roots(int n)
 {
 	int i;
 	V t;
-	for (i = 0; i < root_size; i++)
+	for (i = 0; i < n; i++)
 	{
 		t = roots[i];
 		if (t->color == Purple)
@@ -301,7 +372,7 @@ void scan_black(V);
 
 void scan_black_child(V child)
 {
-	if (isInt(child) || child->type == T_IDENT)
+	if (!isPointer(child) || child->type == T_IDENT)
 		return;
 
 	if (child != NULL)
@@ -323,7 +394,7 @@ void scan_black(V t)
 
 void scan(V t)
 {
-	if (isInt(t) || t->type == T_IDENT)
+	if (!isPointer(t) || t->type == T_IDENT)
 		return;
 
 	if (t->color == Gray)
@@ -340,10 +411,10 @@ void scan(V t)
 	}
 }
 
-void scan_roots(void)
+void scan_roots(int n)
 {
 	int i;
-	for (i = 0; i < root_size; i++)
+	for (i = 0; i < n; i++)
 	{
 		if (roots[i] != NULL)
 		{
@@ -354,46 +425,87 @@ void scan_roots(void)
 
 void collect_white(V t)
 {
-	if (isInt(t) || t->type == T_IDENT)
+	if (!isPointer(t) || t->type == T_IDENT)
 		return;
 
-	if (t->color == White && !t->buffered)
+	if (t->color == White)
 	{
 		t->color = Black;
 		iter_children(t, collect_white);
-		free_value(t);
+		gc_stats.cycles_reclaimed++;
+		if (!t->buffered)
+		{
+			free_value(t);
+		}
+		// otherwise it is freed when its slot in the buffer comes round
 	}
 }
 
-void collect_roots(void)
+// collect the first n candidates and remove them from the buffer
+void collect_roots(int n)
 {
 	int i;
 	V t;
-	for (i = 0; i < root_size; i++)
+	for (i = 0; i < n; i++)
 	{
 		if (roots[i] != NULL)
 		{
 			t = roots[i];
 			t->buffered = false;
 			roots[i] = NULL;
-			collect_white(t);
+			if (t->color == Black && t->refs == 0)
+			{ // collected through an earlier candidate
+				free_value(t);
+			}
+			else
+			{
+				collect_white(t);
+			}
 		}
 	}
-	root_size = 0;
+	root_size -= n;
+	memmove(roots, roots + n, root_size * sizeof(V));
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void collect_candidates(int n)
+{
+	double t0 = now();
+	mark_roots(n);
+	double t1 = now();
+	scan_roots(n);
+	double t2 = now();
+	collect_roots(n);
+	double t3 = now();
+	gc_stats.collections++;
+	gc_stats.mark_time += t1 - t0;
+	gc_stats.scan_time += t2 - t1;
+	gc_stats.collect_time += t3 - t2;
 }
 
 void collect_cycles(void)
 {
 	DBG_PRINT("Starting GC cycle...");
-	mark_roots();
-	scan_roots();
-	collect_roots();
+	collect_candidates(root_size);
+	gc_pending = false;
 	DBG_PRINT("... GC done");
 }
 
+void collect_slice(void)
+{
+	collect_candidates(root_size < gc_slice ? root_size : gc_slice);
+	gc_pending = root_size > 0;
+}
+
 void clear_ref(V t)
 {
-	if (t == NULL || isInt(t) || t->type == T_IDENT)
+	if (t == NULL || !isPointer(t) || t->type == T_IDENT)
 		return;
 
 	if (--t->refs == 0)
@@ -408,7 +520,7 @@ void clear_ref(V t)
 
 void clear_base_ref(V t)
 {
-	if (t == NULL || isInt(t) || t->type == T_IDENT)
+	if (t == NULL || !isPointer(t) || t->type == T_IDENT)
 		return;
 
 	t->baserefs--;
@@ -418,7 +530,7 @@ void clear_base_ref(V t)
 
 V clear_rooted(V t)
 {
-	if (t == NULL || isInt(t) || t->type == T_IDENT)
+	if (t == NULL || !isPointer(t) || t->type == T_IDENT)
 		return t;
 
 	t->baserefs--;
@@ -428,5 +540,45 @@ V clear_rooted(V t)
 
 bool is_simple(V t)
 {
-	return t == NULL || isInt(t) || t->type == T_IDENT || t->color == Green;
+	return t == NULL || !isPointer(t) || t->type == T_IDENT || t->color == Green;
+}
+
+const char* value_type_name(int type)
+{
+	static const char* names[N_VALUE_TYPES] = {
+		[T_IDENT] = "ident",
+		[T_STR] = "str",
+		[T_NUM] = "num",
+		[T_LIST] = "list",
+		[T_FUNC] = "func",
+		[T_DICT] = "dict",
+		[T_PAIR] = "pair",
+		[T_FRAC] = "frac",
+		[T_BIGINT] = "bigint",
+		[T_BIGFRAC] = "bigfrac",
+		[T_SCOPE] = "scope",
+		[T_FILE] = "file",
+		[T_CFUNC] = "cfunc",
+	};
+	return type < N_VALUE_TYPES ? names[type] : NULL;
+}
+
+void print_gc_stats(FILE* f)
+{
+	int i;
+	fputs("gc: type         allocs       frees        live\n", f);
+	for (i = 0; i < N_VALUE_TYPES; i++)
+	{
+		if (gc_stats.allocs[i] > 0)
+		{
+			fprintf(f, "gc: %-7s %11lu %11lu %11lu\n", value_type_name(i),
+				gc_stats.allocs[i], gc_stats.frees[i], gc_stats.allocs[i] - gc_stats.frees[i]);
+		}
+	}
+	fprintf(f, "gc: collections: %lu\n", gc_stats.collections);
+	fprintf(f, "gc: roots buffered: %lu\n", gc_stats.roots_buffered);
+	fprintf(f, "gc: cycles reclaimed: %lu values\n", gc_stats.cycles_reclaimed);
+	fprintf(f, "gc: time: mark %.6fs, scan %.6fs, collect %.6fs\n",
+		gc_stats.mark_time, gc_stats.scan_time, gc_stats.collect_time);
+	fprintf(f, "gc: live bytes: %zu, peak: %zu\n", gc_stats.live_bytes, gc_stats.peak_bytes);
 }
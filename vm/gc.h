@@ -1,8 +1,32 @@
 #ifndef GC_DEF
 #define GC_DEF
 
+#include <stdio.h>
+
 #include "value.h"
 
+#define N_VALUE_TYPES 0x13
+
+typedef struct GCStats
+{
+	unsigned long allocs[N_VALUE_TYPES];
+	unsigned long frees[N_VALUE_TYPES];
+	unsigned long collections;      // every collect_cycles or collect_slice
+	unsigned long roots_buffered;
+	unsigned long cycles_reclaimed; // values freed as part of a garbage cycle
+	double mark_time;               // seconds spent in each phase
+	double scan_time;
+	double collect_time;
+	size_t live_bytes;
+	size_t peak_bytes;
+} GCStats;
+
+extern GCStats gc_stats;
+
+extern int gc_root_limit;
+extern int gc_slice;
+extern bool gc_pending;
+
 #define new_value(t) make_new_value(t, false, 0)
 
 V make_new_value(int, bool, int);
@@ -13,6 +37,10 @@ void clear_ref(V);
 V clear_rooted(V);
 void clear_base_ref(V);
 void collect_cycles(void);
+void collect_slice(void);
 bool is_simple(V);
+void count_new_value(int, size_t);
+const char* value_type_name(int);
+void print_gc_stats(FILE*);
 
 #endif
@@ -6,6 +6,22 @@
 #include "types.h"
 #include "scope.h"
 #include "strings.h"
+#include "bigint.h"
+
+/* The table uses open addressing with Robin Hood hashing: every
+ * entry is kept as close to its home bucket as possible, and an
+ * insertion takes the place of any entry that is closer to home than
+ * the one being inserted. This keeps probe sequences short, and lets
+ * a lookup stop as soon as it passes an entry closer to its home than
+ * the key would be. Entries store their hash, so resizing never needs
+ * to call get_hash.
+ * The size is always a power of two, and the load factor at most 7/8.
+ */
+
+#define MIN_SIZE 4
+#define EMPTY(b) ((b)->key == NULL)
+#define HOME(hash, size) ((hash) & ((size) - 1))
+#define DISTANCE(b, i, size) (((i) - HOME((b)->hash, size)) & ((size) - 1))
 
 HashMap* new_hashmap(int initialsize)
 {
@@ -38,21 +54,37 @@ void hashmap_from_scope(V v_scope, int initialsize)
 uint32_t get_hash(V v)
 {
 	int t = getType(v);
-	if (t == T_STR)
+	if (t == T_IDENT)
+	{
+		return toIdent(v)->hash;
+	}
+	else if (t == T_STR)
 	{
 		return need_hash(v);
 	}
 	else if (t == T_NUM)
-	{
-		return (uint32_t)toNumber(v);
+	{ // equal compares numbers as doubles, so they are hashed as doubles
+		return mix_hash(doubleToBits(toNumber(v)));
 	}
 	else if (t == T_PAIR)
 	{
-		return get_hash(toFirst(v)) + get_hash(toSecond(v));
+		if (toPairHash(v) == 0)
+		{
+			toPairHash(v) = mix_hash(((uint64_t)get_hash(toFirst(v)) << 32) | get_hash(toSecond(v)));
+		}
+		return toPairHash(v);
 	}
 	else if (t == T_FRAC)
 	{
-		return toNumerator(v) ^ toDenominator(v);
+		return mix_hash(toNumerator(v) * 0x9e3779b97f4a7c15ull ^ toDenominator(v));
+	}
+	else if (t == T_BIGINT)
+	{
+		return bigint_hash(v);
+	}
+	else if (t == T_BIGFRAC)
+	{
+		return mix_hash(((uint64_t)get_hash(toBigFrac(v)->numerator) << 32) | get_hash(toBigFrac(v)->denominator));
 	}
 	else
 	{
@@ -67,176 +99,200 @@ uint32_t get_hash(V v)
 	}
 }
 
-V get_hashmap(HashMap* hm, V key)
+
+static int round_size(int size)
 {
-	V actual = real_get_hashmap(hm, key);
-	return actual ? actual : hm->asdefault;
+	int n = MIN_SIZE;
+	while (n < size)
+	{
+		n <<= 1;
+	}
+	return n;
 }
 
-V real_get_hashmap(HashMap* hm, V key)
+static Bucket* find_bucket(HashMap* hm, V key)
 {
-	if (hm->map == NULL)
+	if (hm->map == NULL || hm->used == 0)
 	{
 		return NULL;
 	}
-	Bucket* b = hm->map[get_hash(key) % hm->size];
-	while (b != NULL)
+	uint32_t hash = get_hash(key);
+	uint32_t mask = hm->size - 1;
+	uint32_t i = HOME(hash, hm->size);
+	uint32_t dist = 0;
+	Bucket *b;
+	for (;;)
 	{
-		if (equal(key, b->key))
+		b = &hm->map[i];
+		if (EMPTY(b) || DISTANCE(b, i, hm->size) < dist)
 		{
-			return b->value;
+			return NULL;
 		}
-		b = b->next;
+		if (b->hash == hash && equal(key, b->key))
+		{
+			return b;
+		}
+		i = (i + 1) & mask;
+		dist++;
 	}
-	return NULL;
 }
 
-Bucket* new_bucket(V key, V value)
+V get_hashmap(HashMap* hm, V key)
 {
-	Bucket* b = malloc(sizeof(Bucket));
-	b->key = add_ref(key);
-	b->value = add_ref(value);
-	b->next = NULL;
-	return b;
+	V actual = real_get_hashmap(hm, key);
+	return actual ? actual : hm->asdefault;
 }
 
-bool set_to_bucket(Bucket* b, V key, V value)
+V real_get_hashmap(HashMap* hm, V key)
 {
-	if (equal(b->key, key))
-	{
-		V tmp = b->value;
-		b->value = add_ref(value);
-		clear_ref(tmp);
-		return false;
-	}
-	if (b->next == NULL)
-	{
-		b->next = new_bucket(key, value);
-		return true;
-	}
-	else
-	{
-		return set_to_bucket(b->next, key, value);
-	}
+	Bucket* b = find_bucket(hm, key);
+	return b != NULL ? b->value : NULL;
 }
 
-void set_hashmap(HashMap* hm, V key, V value)
+// like real_get_hashmap, but returns the location of the value
+// it stays valid until the next insertion or deletion
+V* get_hashmap_ref(HashMap* hm, V key)
 {
-	if (hm->map == NULL)
-	{
-		Bucket **bl = calloc(hm->size, sizeof(Bucket*));
-		hm->map = bl;
-	}
-	uint32_t hash = get_hash(key) % hm->size;
-	Bucket* b = hm->map[hash];
-	if (b == NULL)
-	{
-		hm->map[hash] = new_bucket(key, value);
-		hm->used++;
-	}
-	else
+	Bucket* b = find_bucket(hm, key);
+	return b != NULL ? &b->value : NULL;
+}
+
+// place an entry known not to be in the map yet, starting the search
+// for a spot at bucket i, dist buckets away from its home; the map
+// takes over the references of the caller
+static void place_bucket(HashMap* hm, uint32_t i, uint32_t dist, Bucket entry)
+{
+	uint32_t mask = hm->size - 1;
+	uint32_t d;
+	Bucket tmp;
+	Bucket *b;
+	for (;;)
 	{
-		if (set_to_bucket(b, key, value))
+		b = &hm->map[i];
+		if (EMPTY(b))
 		{
-			hm->used++;
+			*b = entry;
+			return;
 		}
-	}
-	if (hm->used > hm->size)
-	{
-		resize_hashmap(hm, hm->size * 2);
+		d = DISTANCE(b, i, hm->size);
+		if (d < dist)
+		{ // rob the rich
+			tmp = *b;
+			*b = entry;
+			entry = tmp;
+			dist = d;
+		}
+		i = (i + 1) & mask;
+		dist++;
 	}
 }
 
-bool change_bucket(Bucket* b, V key, V value)
+void set_hashmap(HashMap* hm, V key, V value)
 {
-	if (equal(b->key, key))
+	if (hm->map == NULL)
 	{
-		V tmp = b->value;
-		b->value = add_ref(value);
-		clear_ref(tmp);
-		return true;
+		hm->size = round_size(hm->size);
+		hm->map = calloc(hm->size, sizeof(Bucket));
 	}
-	if (b->next == NULL)
+	uint32_t hash = get_hash(key);
+	uint32_t mask = hm->size - 1;
+	uint32_t i = HOME(hash, hm->size);
+	uint32_t dist = 0;
+	Bucket *b;
+	for (;;)
 	{
-		return false;
+		b = &hm->map[i];
+		if (EMPTY(b) || DISTANCE(b, i, hm->size) < dist)
+		{ // not found, and this is where it goes
+			break;
+		}
+		if (b->hash == hash && equal(key, b->key))
+		{
+			V tmp = b->value;
+			b->value = add_ref(value);
+			clear_ref(tmp);
+			return;
+		}
+		i = (i + 1) & mask;
+		dist++;
 	}
-	else
+	Bucket entry = {hash, add_ref(key), add_ref(value)};
+	if ((hm->used + 1) * 8 > hm->size * 7)
 	{
-		return change_bucket(b->next, key, value);
+		resize_hashmap(hm, hm->size * 2);
+		i = HOME(hash, hm->size);
+		dist = 0;
 	}
+	place_bucket(hm, i, dist, entry);
+	hm->used++;
 }
 
 bool change_hashmap(HashMap* hm, V key, V value)
 {
-	if (hm->map == NULL)
-	{
-		return false;
-	}
-
-	Bucket* b = hm->map[get_hash(key) % hm->size];
+	Bucket* b = find_bucket(hm, key);
 	if (b == NULL)
 	{
 		return false;
 	}
-	else
-	{
-		return change_bucket(b, key, value);
-	}
+	V tmp = b->value;
+	b->value = add_ref(value);
+	clear_ref(tmp);
+	return true;
 }
 
 void resize_hashmap(HashMap* hm, int newsize)
 {
-	Bucket** bl = calloc(newsize, sizeof(Bucket*));
+	Bucket* old = hm->map;
+	int oldsize = hm->size;
 	int i;
-	int h;
-	Bucket* bb;
-	for (i = 0; i < hm->size; i++)
-	{ //rehash!
-		Bucket *b = hm->map[i];
-		while (b)
+	hm->size = round_size(newsize);
+	hm->map = calloc(hm->size, sizeof(Bucket));
+	if (old == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < oldsize; i++)
+	{ //no need to rehash
+		if (!EMPTY(&old[i]))
 		{
-			h = get_hash(b->key) % newsize;
-			bb = b->next;
-			b->next = bl[h];
-			bl[h] = b;
-			b = bb;
+			place_bucket(hm, HOME(old[i].hash, hm->size), 0, old[i]);
 		}
 	}
-	free(hm->map);
-	hm->map = bl;
-	hm->size = newsize;
+	free(old);
 }
 
 bool delete_hashmap(HashMap *hm, V key)
 {
-	if (hm->map == NULL)
+	Bucket* b = find_bucket(hm, key);
+	if (b == NULL)
 	{
 		return false;
 	}
-	Bucket **bprev = &hm->map[get_hash(key) % hm->size];
-	Bucket *b = *bprev;
-	while (b != NULL)
+	V old_key = b->key;
+	V value = b->value;
+	// shift the following entries back towards their home
+	uint32_t mask = hm->size - 1;
+	uint32_t i = b - hm->map;
+	uint32_t next = (i + 1) & mask;
+	while (!EMPTY(&hm->map[next]) && DISTANCE(&hm->map[next], next, hm->size) > 0)
 	{
-		if (equal(key, b->key))
-		{
-			*bprev = b->next;
-			clear_ref(b->key);
-			clear_ref(b->value);
-			free(b);
-			hm->used--;
-			if ((hm->used < hm->size / 2) && (hm->size > 16))
-			{
-				resize_hashmap(hm, hm->size / 2);
-			}
-			return true;
-		}
-		bprev = &(*bprev)->next;
-		b = b->next;
+		hm->map[i] = hm->map[next];
+		i = next;
+		next = (next + 1) & mask;
+	}
+	hm->map[i].key = NULL;
+	hm->map[i].value = NULL;
+	hm->used--;
+	if ((hm->used < hm->size / 4) && (hm->size > MIN_SIZE))
+	{
+		resize_hashmap(hm, hm->size / 2);
 	}
-	return false;
+	clear_ref(old_key);
+	clear_ref(value);
+	return true;
 }
 
-// make sure to only call this if old->size == new->size
+// copies all entries of old into new
 void copy_hashmap(HashMap *old, HashMap *new)
 {
 	int i;
@@ -244,19 +300,52 @@ void copy_hashmap(HashMap *old, HashMap *new)
 	{
 		return;
 	}
-	if (new->map == NULL)
+	if (new->map == NULL && new->used == 0 && round_size(new->size) == old->size)
 	{
-		new->map = calloc(new->size, sizeof(Bucket*));
+		new->size = old->size;
+		new->map = malloc(old->size * sizeof(Bucket));
+		memcpy(new->map, old->map, old->size * sizeof(Bucket));
+		new->used = old->used;
+		for (i = 0; i < old->size; i++)
+		{
+			if (!EMPTY(&old->map[i]))
+			{
+				add_ref(old->map[i].key);
+				add_ref(old->map[i].value);
+			}
+		}
+		return;
 	}
 	for (i = 0; i < old->size; i++)
 	{
-		Bucket *b = old->map[i];
-		Bucket **newb = new->map + i;
-		while (b)
+		if (!EMPTY(&old->map[i]))
+		{
+			set_hashmap(new, old->map[i].key, old->map[i].value);
+		}
+	}
+}
+
+// how many buckets finding each key looks at, in total and at most
+void hashmap_probes(HashMap* hm, unsigned long* total, int* longest)
+{
+	int i;
+	int d;
+	*total = 0;
+	*longest = 0;
+	if (hm->map == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < hm->size; i++)
+	{
+		if (!EMPTY(&hm->map[i]))
 		{
-			*newb = new_bucket(b->key, b->value);
-			b = b->next;
-			newb = &(*newb)->next;
+			d = DISTANCE(&hm->map[i], i, hm->size) + 1;
+			*total += d;
+			if (d > *longest)
+			{
+				*longest = d;
+			}
 		}
 	}
 }
@@ -5,18 +5,19 @@
 
 #include "value.h"
 
+// an entry of a HashMap; empty if key is NULL
 typedef struct Bucket
 {
+	uint32_t hash;
 	V key;
 	V value;
-	struct Bucket *next;
 } Bucket;
 
 typedef struct HashMap
 {
 	int used;
 	int size;
-	Bucket** map;
+	Bucket* map;
 	V asdefault;
 } HashMap;
 
@@ -25,10 +26,12 @@ void hashmap_from_value(V, int);
 void hashmap_from_scope(V, int);
 V get_hashmap(HashMap*, V);
 V real_get_hashmap(HashMap*, V);
+V* get_hashmap_ref(HashMap*, V);
 bool delete_hashmap(HashMap*, V);
 void set_hashmap(HashMap*, V, V);
 bool change_hashmap(HashMap*, V, V);
 void resize_hashmap(HashMap*, int);
 void copy_hashmap(HashMap*, HashMap*);
+void hashmap_probes(HashMap*, unsigned long*, int*);
 
 #endif
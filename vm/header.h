@@ -2,7 +2,7 @@
 #define HEADER_DEF
 
 #define MAGIC "\aDV"
-#define VERSION '\x03'
+#define VERSION '\x09'
 
 #include <netinet/in.h>
 #include <stdint.h>
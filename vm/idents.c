@@ -1,78 +1,118 @@
 #include "idents.h"
+#include "strings.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 
-static ITreeNode *ident_store = NULL;
+/* The intern table.
+ * Every ident exists once, and is found through an open addressed
+ * table with linear probing. Idents keep their hash, so probing only
+ * compares strings when the hashes match, growing the table never
+ * rehashes a string, and get_hash can use it directly.
+ * Idents are never freed, so they are bumped out of chunks of their
+ * own, next to each other.
+ */
 
-ITreeNode *create_ident(size_t length, const char *data)
-{
-	ITreeNode *new = malloc(sizeof(ITreeNode) + length);
-	new->type = T_IDENT;
-	new->length = length;
-	memcpy(new->data, data, length + 1);
-	new->left = NULL;
-	new->right = NULL;
-	return new;
-}
+#define MIN_IDENTS 1024
+#define IDENT_CHUNK (64 * 1024)
+
+static ITreeNode **ident_table = NULL;
+static uint32_t table_size = 0;
+static uint32_t n_idents = 0;
+
+static char *chunk_next = NULL;
+static char *chunk_end = NULL;
 
-V lookup_ident_at(ITreeNode **loc, size_t length, const char *data)
+static ITreeNode *ident_alloc(size_t size)
 {
-	if (!*loc)
+	void *p;
+	size = (size + 7) & ~(size_t)7;
+	if (size > IDENT_CHUNK / 4)
 	{
-		*loc = create_ident(length, data);
-		return (V)(*loc);
+		return malloc(size);
 	}
-	int cmp = memcmp(data, (*loc)->data, length <= (*loc)->length ? length : (*loc)->length);
-	if (!cmp)
-	{ // to prevent :he to compare equal to :hello
-		cmp = length - (*loc)->length;
-	}
-	if (cmp == 0)
-	{
-		return (V)(*loc);
-	}
-	else if (cmp < 0)
-	{
-		return lookup_ident_at(&(*loc)->left, length, data);
-	}
-	else
-	{
-		return lookup_ident_at(&(*loc)->right, length, data);
+	if (chunk_next == NULL || chunk_next + size > chunk_end)
+	{ // the rest of the old chunk is lost
+		chunk_next = malloc(IDENT_CHUNK);
+		chunk_end = chunk_next + IDENT_CHUNK;
 	}
+	p = chunk_next;
+	chunk_next += size;
+	return p;
 }
 
-V lookup_ident(size_t length, const const char *data)
+static ITreeNode *create_ident(size_t length, const char *data, uint32_t hash)
 {
-	return lookup_ident_at(&ident_store, length, data);
+	ITreeNode *new = ident_alloc(sizeof(ITreeNode) + length);
+	new->type = T_IDENT;
+	new->length = length;
+	new->bound_locally = false;
+	new->hash = hash;
+	memcpy(new->data, data, length);
+	new->data[length] = '\0';
+	return new;
 }
 
-int count_idents_at(ITreeNode *loc)
+static void grow_table(void)
 {
-	if (!loc)
+	ITreeNode **old = ident_table;
+	uint32_t old_size = table_size;
+	uint32_t i, j;
+	table_size = table_size ? table_size * 2 : MIN_IDENTS;
+	ident_table = calloc(table_size, sizeof(ITreeNode*));
+	for (i = 0; i < old_size; i++)
 	{
-		return 0;
+		if (old[i])
+		{
+			for (j = old[i]->hash & (table_size - 1); ident_table[j]; j = (j + 1) & (table_size - 1));
+			ident_table[j] = old[i];
+		}
 	}
-	return 1 + count_idents_at(loc->left) + count_idents_at(loc->right);
+	free(old);
 }
 
-int ident_count()
+V lookup_ident(size_t length, const char *data)
 {
-	return count_idents_at(ident_store);
+	uint32_t hash = new_string_hash(length, data);
+	uint32_t i;
+	ITreeNode *id;
+	if (2 * (n_idents + 1) > table_size)
+	{ // keep the table at most half full
+		grow_table();
+	}
+	for (i = hash & (table_size - 1); (id = ident_table[i]); i = (i + 1) & (table_size - 1))
+	{
+		if (id->hash == hash && id->length == length && !memcmp(id->data, data, length))
+		{
+			return (V)id;
+		}
+	}
+	ident_table[i] = create_ident(length, data, hash);
+	n_idents++;
+	return (V)ident_table[i];
 }
 
-int ident_depth_at(ITreeNode *loc)
+int ident_count()
 {
-	if (!loc)
-	{
-		return 0;
-	}
-	int ldepth = ident_depth_at(loc->left);
-	int rdepth = ident_depth_at(loc->right);
-	return 1 + (ldepth > rdepth ? ldepth : rdepth);
+	return n_idents;
 }
 
+// the longest probe sequence in the table
 int ident_depth()
 {
-	return ident_depth_at(ident_store);
+	uint32_t i;
+	uint32_t probes;
+	uint32_t longest = 0;
+	for (i = 0; i < table_size; i++)
+	{
+		if (ident_table[i])
+		{
+			probes = ((i - ident_table[i]->hash) & (table_size - 1)) + 1;
+			if (probes > longest)
+			{
+				longest = probes;
+			}
+		}
+	}
+	return longest;
 }
@@ -0,0 +1,46 @@
+#ifndef INSTRUCTION_DEF
+#define INSTRUCTION_DEF
+
+#include "value.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A per-instruction cache for name lookups.
+// It is valid as long as key matches and version equals binding_version.
+typedef struct InlineCache
+{
+	V key;
+	V *slot;
+	unsigned long version;
+	V value; //the function found, for quickened PUSH_WORD
+} InlineCache;
+
+// The local variables of a function that live in slots of its scope
+// instead of in its hash map, in slot order.
+// It also counts calls of the function, for the JIT.
+// A function without LABDA in its body cannot have its scope captured.
+typedef struct Frame
+{
+	int n_slots;
+	V *names;
+	bool escapes;
+	unsigned long calls;
+	struct JitCode *jit;
+} Frame;
+
+// A decoded instruction. The bytecode on disk is big-endian with
+// 24 bit arguments; load_memfile translates it once into this form.
+typedef struct
+{
+	uint32_t opcode;
+	int32_t arg;     //sign extended where the opcode takes a signed argument
+	V literal;       //resolved literal for opcodes that refer to one
+	union
+	{
+		InlineCache *cache; //for opcodes that look up names
+		Frame *frame;       //for LABDA
+	};
+} Instruction;
+
+#endif
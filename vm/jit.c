@@ -0,0 +1,978 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "opcodes.h"
+#include "lib.h"
+#include "strings.h"
+#include "profile.h"
+
+/* The JIT.
+ * With --jit, every function that has been called JIT_THRESHOLD times
+ * is translated to x86-64 machine code: a template per instruction,
+ * stitched together in the order of the bytecode. Most templates call
+ * a helper below with the JitFrame and the instruction; JMP and the
+ * branch of JMPZ become native jumps. A helper returns
+ *  JIT_NEXT     to go on with the next instruction,
+ *  JIT_BRANCH   to take the branch of a jump,
+ *  JIT_EXIT     when do_instructions has to return frame->e, because
+ *               the scope stack changed or an error was raised,
+ *  JIT_REENTER  when control went somewhere the native code cannot
+ *               follow by itself; sc->pc says where.
+ * Rare instructions, and the slow and failing paths of the others, are
+ * handed to the interpreter one at a time through step_instruction.
+ *
+ * do_instructions calls jit_run before interpreting anything, so code
+ * that is compiled always runs natively, including when a call returns
+ * into it or an error is handled in it.
+ * The addresses of compiled functions are written to /tmp/perf-PID.map,
+ * for perf to pick up.
+ */
+
+#define JIT_THRESHOLD 100
+
+#define JIT_NEXT 0
+#define JIT_BRANCH -1
+#define JIT_EXIT 1
+#define JIT_REENTER 2
+
+extern V lastCall;
+
+bool vm_jit = false;
+
+typedef struct JitFrame
+{
+	Stack *S;
+	Stack *scope_arr;
+	V scope;
+	Scope *sc;
+	Error e;
+} JitFrame;
+
+typedef int (*JitHelper)(JitFrame*, Instruction*);
+
+typedef struct JitCode
+{
+	unsigned char *mem;
+	size_t size;
+	Instruction *start;
+	uint32_t length;
+	int (*enter)(JitFrame*, void*);
+	void **entries;
+} JitCode;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+static int jit_step(JitFrame *f, Instruction *pc)
+{
+	Scope *sc = f->sc;
+	sc->pc = pc - 1;
+	f->e = step_instruction(f->S, f->scope_arr);
+	if (f->e != Nothing || get_head(f->scope_arr) != f->scope)
+	{
+		return JIT_EXIT;
+	}
+	return sc->pc == pc ? JIT_NEXT : JIT_REENTER;
+}
+
+// go on in the interpreter at pc
+static int jit_stop(JitFrame *f, Instruction *pc)
+{
+	f->sc->pc = pc - 1;
+	return JIT_REENTER;
+}
+
+// what PUSH_WORD does with the value v of its word
+static int jit_call(JitFrame *f, Instruction *pc, V v)
+{
+	Stack *S = f->S;
+	Scope *sc = f->sc;
+	if (v == NULL)
+	{
+		return jit_step(f, pc);
+	}
+	if (getType(v) == T_FUNC)
+	{
+		sc->pc = pc;
+		push(f->scope_arr, add_rooted(new_function_scope(v)));
+		f->e = Nothing;
+		return JIT_EXIT;
+	}
+	if (getType(v) == T_CFUNC)
+	{
+		sc->pc = pc;
+		if (vm_profile)
+		{
+			profile_cfunc(toCFunc(v));
+		}
+		f->e = toCFunc(v)(S, f->scope_arr);
+		if (f->e != Nothing || get_head(f->scope_arr) != f->scope)
+		{
+			return JIT_EXIT;
+		}
+		return sc->pc == pc ? JIT_NEXT : JIT_REENTER;
+	}
+	pushS(add_ref(v));
+	return JIT_NEXT;
+}
+
+static int jit_push_literal(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	pushS(add_ref(pc->literal));
+	return JIT_NEXT;
+}
+
+static int jit_push_integer(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	pushS(int_to_value(pc->arg));
+	return JIT_NEXT;
+}
+
+static int jit_line_number(JitFrame *f, Instruction *pc)
+{
+	f->sc->linenr = pc->arg;
+	return JIT_NEXT;
+}
+
+static int jit_push_slot(JitFrame *f, Instruction *pc)
+{
+	Scope *sc = f->sc;
+	V v;
+	if (sc->slots == NULL || (v = sc->slots[pc->arg]) == NULL)
+	{
+		v = lookup_slot(sc, pc->literal, pc->arg);
+	}
+	lastCall = pc->literal;
+	return jit_call(f, pc, v);
+}
+
+static int jit_get_slot(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	Scope *sc = f->sc;
+	V v;
+	if ((sc->slots == NULL || (v = sc->slots[pc->arg]) == NULL) &&
+		(v = lookup_slot(sc, pc->literal, pc->arg)) == NULL)
+	{
+		return jit_step(f, pc);
+	}
+	pushS(add_ref(v));
+	return JIT_NEXT;
+}
+
+static int jit_set_slot(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	Scope *sc = f->sc;
+	V v;
+	if (stack_size(S) < 1)
+	{
+		return jit_step(f, pc);
+	}
+	v = popS();
+	if (sc->slots != NULL && sc->slots[pc->arg] != NULL)
+	{
+		V old = sc->slots[pc->arg];
+		sc->slots[pc->arg] = v;
+		clear_ref(old);
+	}
+	else
+	{
+		set_slot(sc, pc->literal, pc->arg, v);
+		clear_ref(v);
+	}
+	return JIT_NEXT;
+}
+
+static int jit_set_local_slot(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	Scope *sc = f->sc;
+	V v;
+	if (stack_size(S) < 1)
+	{
+		return jit_step(f, pc);
+	}
+	v = popS();
+	if (sc->slots != NULL)
+	{
+		V old = sc->slots[pc->arg];
+		sc->slots[pc->arg] = v;
+		clear_ref(old);
+	}
+	else
+	{
+		set_in_scope(sc, pc->literal, v);
+		clear_ref(v);
+	}
+	return JIT_NEXT;
+}
+
+static int jit_jmpz(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	V v;
+	bool t;
+	if (stack_size(S) < 1)
+	{
+		return jit_step(f, pc);
+	}
+	v = popS();
+	t = truthy(v);
+	clear_ref(v);
+	return t ? JIT_NEXT : JIT_BRANCH;
+}
+
+static int jit_drop(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	if (stack_size(S) < 1)
+	{
+		return jit_step(f, pc);
+	}
+	clear_ref(popS());
+	return JIT_NEXT;
+}
+
+static int jit_dup(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	if (stack_size(S) < 1)
+	{
+		return jit_step(f, pc);
+	}
+	pushS(add_ref(get_head(S)));
+	return JIT_NEXT;
+}
+
+static int jit_swap(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	V v;
+	if (stack_size(S) < 2)
+	{
+		return jit_step(f, pc);
+	}
+	v = S->nodes[S->used - 1];
+	S->nodes[S->used - 1] = S->nodes[S->used - 2];
+	S->nodes[S->used - 2] = v;
+	return JIT_NEXT;
+}
+
+static int jit_over(JitFrame *f, Instruction *pc)
+{
+	Stack *S = f->S;
+	if (stack_size(S) < 2)
+	{
+		return jit_step(f, pc);
+	}
+	pushS(add_ref(S->nodes[S->used - 2]));
+	return JIT_NEXT;
+}
+
+// like LOOKUP in opcodes.c
+static V jit_lookup(JitFrame *f, Instruction *pc)
+{
+	V key = pc->literal;
+	lastCall = key;
+	if (pc->cache->key == key && pc->cache->version == binding_version)
+	{
+		return *pc->cache->slot;
+	}
+	return lookup_name(f->sc, key, pc->cache);
+}
+
+static int jit_push_word(JitFrame *f, Instruction *pc)
+{
+	return jit_call(f, pc, jit_lookup(f, pc));
+}
+
+static int jit_enter_scope(JitFrame *f, Instruction *pc)
+{
+	f->sc->pc = pc;
+	push(f->scope_arr, add_rooted(new_scope(f->scope)));
+	f->e = Nothing;
+	return JIT_EXIT;
+}
+
+static int jit_leave_scope(JitFrame *f, Instruction *pc)
+{
+	clear_base_ref(pop(f->scope_arr));
+	toScope(get_head(f->scope_arr))->pc = pc;
+	f->e = Nothing;
+	return JIT_EXIT;
+}
+
+static int jit_leave_scope_jmp(JitFrame *f, Instruction *pc)
+{
+	clear_base_ref(pop(f->scope_arr));
+	toScope(get_head(f->scope_arr))->pc = pc + pc[1].arg;
+	f->e = Nothing;
+	return JIT_EXIT;
+}
+
+// like BINARY_OP in opcodes.c
+#define JIT_BINARY(name, cfunc, int_case) \
+static int name(JitFrame *f, Instruction *pc) \
+{ \
+	Stack *S = f->S; \
+	V v = jit_lookup(f, pc); \
+	if (v != NULL && getType(v) == T_CFUNC && toCFunc(v) == (cfunc) && \
+		stack_size(S) >= 2 && isInt(S->nodes[S->used - 1]) && isInt(S->nodes[S->used - 2])) \
+	{ \
+		long int a = toInt(S->nodes[S->used - 1]); \
+		long int b = toInt(S->nodes[S->used - 2]); \
+		int_case \
+	} \
+	return jit_call(f, pc, v); \
+}
+
+#define JIT_INT_RESULT(r) \
+	if (canBeInt(r)) \
+	{ \
+		S->used--; \
+		S->nodes[S->used - 1] = intToV(r); \
+		return JIT_NEXT; \
+	}
+
+#define JIT_BOOL_RESULT(c) \
+	S->used -= 2; \
+	pushS(add_ref((c) ? v_true : v_false)); \
+	return JIT_NEXT;
+
+JIT_BINARY(jit_add, add, long int r = a + b; JIT_INT_RESULT(r))
+JIT_BINARY(jit_sub, sub, long int r = a - b; JIT_INT_RESULT(r))
+JIT_BINARY(jit_mul, mul, long int r; if (!__builtin_mul_overflow(a, b, &r)) JIT_INT_RESULT(r))
+JIT_BINARY(jit_lt, lt, JIT_BOOL_RESULT(a < b))
+JIT_BINARY(jit_gt, gt, JIT_BOOL_RESULT(a > b))
+JIT_BINARY(jit_le, le, JIT_BOOL_RESULT(a <= b))
+JIT_BINARY(jit_ge, ge, JIT_BOOL_RESULT(a >= b))
+JIT_BINARY(jit_eq, eq, JIT_BOOL_RESULT(a == b))
+
+/* Quickened PUSH_WORD can turn back into PUSH_WORD at any time, so
+ * compiled code does the full lookup; the inline cache keeps it cheap.
+ * Superinstructions are compiled as their first half; the template of
+ * the second half follows anyway. When the interpreter steps one, it
+ * does both halves, and the native code picks up after it.
+ */
+static JitHelper helpers[256] = {
+	[OP_PUSH_LITERAL] = jit_push_literal,
+	[OP_PUSH_INTEGER] = jit_push_integer,
+	[OP_LINE_NUMBER] = jit_line_number,
+	[OP_PUSH_WORD] = jit_push_word,
+	[OP_PUSH_WORD_CFUNC] = jit_push_word,
+	[OP_PUSH_WORD_FUNC] = jit_push_word,
+	[OP_PUSH_WORD_VALUE] = jit_push_word,
+	[OP_PUSH_SLOT] = jit_push_slot,
+	[OP_GET_SLOT] = jit_get_slot,
+	[OP_SET_SLOT] = jit_set_slot,
+	[OP_SET_LOCAL_SLOT] = jit_set_local_slot,
+	[OP_JMPZ] = jit_jmpz,
+	[OP_ENTER_SCOPE] = jit_enter_scope,
+	[OP_LEAVE_SCOPE] = jit_leave_scope,
+	[OP_LEAVE_SCOPE_JMP] = jit_leave_scope_jmp,
+	[OP_DROP] = jit_drop,
+	[OP_DUP] = jit_dup,
+	[OP_DUP_JMPZ] = jit_dup,
+	[OP_SWAP] = jit_swap,
+	[OP_OVER] = jit_over,
+	[OP_ADD] = jit_add,
+	[OP_SUB] = jit_sub,
+	[OP_MUL] = jit_mul,
+	[OP_LT] = jit_lt,
+	[OP_GT] = jit_gt,
+	[OP_LE] = jit_le,
+	[OP_GE] = jit_ge,
+	[OP_EQ] = jit_eq,
+	[OP_LT_JMPZ] = jit_lt,
+	[OP_GT_JMPZ] = jit_gt,
+	[OP_LE_JMPZ] = jit_le,
+	[OP_GE_JMPZ] = jit_ge,
+	[OP_EQ_JMPZ] = jit_eq,
+};
+
+/* Templates.
+ * The frame is kept in rbx. Hot instructions get a fast path in machine
+ * code for tagged ints and slots, guarded the same way as in the
+ * interpreter; when a guard fails, they jump to a slow path at the end
+ * of their template, which calls their helper like any other template.
+ */
+typedef struct Emitter
+{
+	unsigned char *p;
+	unsigned char *slow[16]; // jumps to the slow path of this template
+	int n_slow;
+	unsigned char **fixup_at; // jumps to other instructions
+	uint32_t *fixup_target;
+	uint32_t n_fixups;
+} Emitter;
+
+#define MAX_TEMPLATE 320
+
+static void emit(Emitter *e, const char *bytes, size_t n)
+{
+	memcpy(e->p, bytes, n);
+	e->p += n;
+}
+
+static void emit_imm32(Emitter *e, int32_t imm)
+{
+	memcpy(e->p, &imm, 4);
+	e->p += 4;
+}
+
+static void emit_imm64(Emitter *e, const void *v)
+{
+	uint64_t imm = (uint64_t)(uintptr_t)v;
+	memcpy(e->p, &imm, 8);
+	e->p += 8;
+}
+
+static void patch_rel32(unsigned char *at, const unsigned char *target)
+{
+	int32_t rel = target - (at + 4);
+	memcpy(at, &rel, 4);
+}
+
+// a conditional jump (0f cc) to the slow path
+static void emit_to_slow(Emitter *e, const char *jcc)
+{
+	emit(e, jcc, 2);
+	e->slow[e->n_slow++] = e->p;
+	e->p += 4;
+}
+
+// a jump (e9, or 0f cc) to the template of instruction target
+static void emit_to(Emitter *e, const char *jmp, size_t n, uint32_t target)
+{
+	emit(e, jmp, n);
+	e->fixup_at[e->n_fixups] = e->p;
+	e->fixup_target[e->n_fixups++] = target;
+	e->p += 4;
+}
+
+// call helper(frame, pc)
+static void emit_call(Emitter *e, JitHelper helper, Instruction *pc)
+{
+	emit(e, "\x48\x89\xdf", 3);           // mov rdi, rbx
+	emit(e, "\x48\xbe", 2);               // mov rsi, pc
+	emit_imm64(e, pc);
+	emit(e, "\x48\xb8", 2);               // mov rax, helper
+	emit_imm64(e, helper);
+	emit(e, "\xff\xd0", 2);               // call rax
+}
+
+static void emit_helper(Emitter *e, JitHelper helper, Instruction *pc, unsigned char *leave)
+{
+	emit_call(e, helper, pc);
+	emit(e, "\x85\xc0", 2);               // test eax, eax
+	emit(e, "\x0f\x85", 2);               // jnz leave
+	patch_rel32(e->p, leave);
+	e->p += 4;
+}
+
+// end the fast path, and put the slow path after it
+static void emit_slow_path(Emitter *e, JitHelper helper, Instruction *pc, unsigned char *leave)
+{
+	unsigned char *skip;
+	int i;
+	emit(e, "\xe9", 1);                   // jmp over the slow path
+	skip = e->p;
+	e->p += 4;
+	for (i = 0; i < e->n_slow; i++)
+	{
+		patch_rel32(e->slow[i], e->p);
+	}
+	e->n_slow = 0;
+	emit_helper(e, helper, pc, leave);
+	patch_rel32(skip, e->p);
+}
+
+static void emit_load_stack(Emitter *e)
+{
+	emit(e, "\x48\x8b\xbb", 3);           // mov rdi, [rbx + S]
+	emit_imm32(e, offsetof(JitFrame, S));
+}
+
+static void emit_load_scope(Emitter *e)
+{
+	emit(e, "\x48\x8b\xb3", 3);           // mov rsi, [rbx + sc]
+	emit_imm32(e, offsetof(JitFrame, sc));
+}
+
+static void emit_set_last_call(Emitter *e, V key)
+{
+	emit(e, "\x48\xb8", 2);               // mov rax, &lastCall
+	emit_imm64(e, &lastCall);
+	emit(e, "\x48\xb9", 2);               // mov rcx, key
+	emit_imm64(e, key);
+	emit(e, "\x48\x89\x08", 3);           // mov [rax], rcx
+}
+
+// push the int in rdx on the stack in rdi, unless it has to grow
+static void emit_push_int(Emitter *e)
+{
+	emit(e, "\x8b\x87", 2);               // mov eax, [rdi + used]
+	emit_imm32(e, offsetof(Stack, used));
+	emit(e, "\x3b\x87", 2);               // cmp eax, [rdi + size]
+	emit_imm32(e, offsetof(Stack, size));
+	emit_to_slow(e, "\x0f\x8d");          // jge slow
+	emit(e, "\x48\x8b\x8f", 3);           // mov rcx, [rdi + nodes]
+	emit_imm32(e, offsetof(Stack, nodes));
+	emit(e, "\x48\x89\x14\xc1", 4);       // mov [rcx + rax * 8], rdx
+	emit(e, "\xff\x87", 2);               // inc dword [rdi + used]
+	emit_imm32(e, offsetof(Stack, used));
+}
+
+static void emit_line_number(Emitter *e, Instruction *pc)
+{
+	emit_load_scope(e);
+	emit(e, "\xc7\x86", 2);               // mov dword [rsi + linenr], arg
+	emit_imm32(e, offsetof(Scope, linenr));
+	emit_imm32(e, pc->arg);
+}
+
+static void emit_push_integer(Emitter *e, Instruction *pc, unsigned char *leave)
+{
+	emit_load_stack(e);
+	emit(e, "\x48\xba", 2);               // mov rdx, intToV(arg)
+	emit_imm64(e, intToV((long int)pc->arg));
+	emit_push_int(e);
+	emit_slow_path(e, jit_push_integer, pc, leave);
+}
+
+// r8: the slots of the function, seen through blocks that bind
+// nothing, like lookup_slot; or the slow path
+static void emit_load_slots(Emitter *e)
+{
+	unsigned char *loop;
+	unsigned char *found;
+	emit_load_scope(e);
+	loop = e->p;
+	emit(e, "\x4c\x8b\x86", 3);           // mov r8, [rsi + slots]
+	emit_imm32(e, offsetof(Scope, slots));
+	emit(e, "\x4d\x85\xc0", 3);           // test r8, r8
+	emit(e, "\x0f\x85", 2);               // jnz found
+	found = e->p;
+	e->p += 4;
+	emit(e, "\x80\xbe", 2);               // cmp byte [rsi + is_func_scope], 0
+	emit_imm32(e, offsetof(Scope, is_func_scope));
+	emit(e, "\x00", 1);
+	emit_to_slow(e, "\x0f\x85");          // jne slow
+	emit(e, "\x83\xbe", 2);               // cmp dword [rsi + hm.used], 0
+	emit_imm32(e, offsetof(Scope, hm.used));
+	emit(e, "\x00", 1);
+	emit_to_slow(e, "\x0f\x85");          // jne slow
+	emit(e, "\x48\x8b\xb6", 3);           // mov rsi, [rsi + parent]
+	emit_imm32(e, offsetof(Scope, parent));
+	emit(e, "\x48\x81\xc6", 3);           // add rsi, sizeof(Value): toScope
+	emit_imm32(e, sizeof(Value));
+	emit(e, "\xe9", 1);                   // jmp loop
+	patch_rel32(e->p, loop);
+	e->p += 4;
+	patch_rel32(found, e->p);
+}
+
+static void emit_push_slot(Emitter *e, Instruction *pc, JitHelper helper, unsigned char *leave)
+{
+	emit_load_slots(e);
+	emit(e, "\x49\x8b\x90", 3);           // mov rdx, [r8 + arg * 8]
+	emit_imm32(e, pc->arg * sizeof(V));
+	emit(e, "\xf6\xc2\x01", 3);           // test dl, 1
+	emit_to_slow(e, "\x0f\x84");          // jz slow: not an int, or unset
+	if (BASE_OPCODE(pc->opcode) == OP_PUSH_SLOT)
+	{
+		emit_set_last_call(e, pc->literal);
+	}
+	emit_load_stack(e);
+	emit_push_int(e);
+	emit_slow_path(e, helper, pc, leave);
+}
+
+// replace an int in a slot by an int
+static void emit_set_slot(Emitter *e, Instruction *pc, unsigned char *leave)
+{
+	emit_load_stack(e);
+	emit(e, "\x8b\x87", 2);               // mov eax, [rdi + used]
+	emit_imm32(e, offsetof(Stack, used));
+	emit(e, "\x85\xc0", 2);               // test eax, eax
+	emit_to_slow(e, "\x0f\x84");          // jz slow
+	emit(e, "\x48\x8b\x8f", 3);           // mov rcx, [rdi + nodes]
+	emit_imm32(e, offsetof(Stack, nodes));
+	emit(e, "\x48\x8b\x54\xc1\xf8", 5);   // mov rdx, [rcx + rax * 8 - 8]
+	emit(e, "\xf6\xc2\x01", 3);           // test dl, 1
+	emit_to_slow(e, "\x0f\x84");          // jz slow
+	emit_load_slots(e);
+	emit(e, "\x4d\x8b\x88", 3);           // mov r9, [r8 + arg * 8]
+	emit_imm32(e, pc->arg * sizeof(V));
+	emit(e, "\x41\xf6\xc1\x01", 4);       // test r9b, 1
+	emit_to_slow(e, "\x0f\x84");          // jz slow
+	emit(e, "\x49\x89\x90", 3);           // mov [r8 + arg * 8], rdx
+	emit_imm32(e, pc->arg * sizeof(V));
+	emit(e, "\xff\x8f", 2);               // dec dword [rdi + used]
+	emit_imm32(e, offsetof(Stack, used));
+	emit_slow_path(e, jit_set_slot, pc, leave);
+}
+
+/* The guard of BINARY_OP: the inline cache of the instruction has to be
+ * valid and hold builtin, the value the word had when it was compiled.
+ * Leaves the operands a (top) and b in rax and rdx, and rcx pointing
+ * just past them, or goes to the slow path.
+ */
+static void emit_int_operands(Emitter *e, Instruction *pc, V builtin)
+{
+	emit(e, "\x48\xb8", 2);               // mov rax, cache
+	emit_imm64(e, pc->cache);
+	emit(e, "\x48\xb9", 2);               // mov rcx, key
+	emit_imm64(e, pc->literal);
+	emit(e, "\x48\x39\x88", 3);           // cmp [rax + key], rcx
+	emit_imm32(e, offsetof(InlineCache, key));
+	emit_to_slow(e, "\x0f\x85");          // jne slow
+	emit(e, "\x48\xb9", 2);               // mov rcx, &binding_version
+	emit_imm64(e, &binding_version);
+	emit(e, "\x48\x8b\x09", 3);           // mov rcx, [rcx]
+	emit(e, "\x48\x39\x88", 3);           // cmp [rax + version], rcx
+	emit_imm32(e, offsetof(InlineCache, version));
+	emit_to_slow(e, "\x0f\x85");          // jne slow
+	emit(e, "\x48\x8b\x80", 3);           // mov rax, [rax + slot]
+	emit_imm32(e, offsetof(InlineCache, slot));
+	emit(e, "\x48\x8b\x00", 3);           // mov rax, [rax]
+	emit(e, "\x48\xb9", 2);               // mov rcx, builtin
+	emit_imm64(e, builtin);
+	emit(e, "\x48\x39\xc8", 3);           // cmp rax, rcx
+	emit_to_slow(e, "\x0f\x85");          // jne slow
+	emit_set_last_call(e, pc->literal);
+	emit_load_stack(e);
+	emit(e, "\x8b\x87", 2);               // mov eax, [rdi + used]
+	emit_imm32(e, offsetof(Stack, used));
+	emit(e, "\x83\xf8\x02", 3);           // cmp eax, 2
+	emit_to_slow(e, "\x0f\x8c");          // jl slow
+	emit(e, "\x48\x8b\x8f", 3);           // mov rcx, [rdi + nodes]
+	emit_imm32(e, offsetof(Stack, nodes));
+	emit(e, "\x48\x8d\x0c\xc1", 4);       // lea rcx, [rcx + rax * 8]
+	emit(e, "\x48\x8b\x41\xf8", 4);       // mov rax, [rcx - 8]
+	emit(e, "\x48\x8b\x51\xf0", 4);       // mov rdx, [rcx - 16]
+	emit(e, "\xa8\x01", 2);               // test al, 1
+	emit_to_slow(e, "\x0f\x84");          // jz slow
+	emit(e, "\xf6\xc2\x01", 3);           // test dl, 1
+	emit_to_slow(e, "\x0f\x84");          // jz slow
+}
+
+static void emit_arithmetic(Emitter *e, Instruction *pc, V builtin, unsigned char *leave)
+{
+	uint32_t op = BASE_OPCODE(pc->opcode);
+	emit_int_operands(e, pc, builtin);
+	emit(e, "\x48\xd1\xf8", 3);           // sar rax, 1
+	emit(e, "\x48\xd1\xfa", 3);           // sar rdx, 1
+	if (op == OP_ADD)
+	{
+		emit(e, "\x48\x01\xd0", 3);       // add rax, rdx
+	}
+	else if (op == OP_SUB)
+	{
+		emit(e, "\x48\x29\xd0", 3);       // sub rax, rdx
+	}
+	else
+	{
+		emit(e, "\x48\x0f\xaf\xc2", 4);   // imul rax, rdx
+		emit_to_slow(e, "\x0f\x80");      // jo slow
+	}
+	// canBeInt
+	emit(e, "\x49\xb8", 2);               // mov r8, INTPTR_MAX >> 1
+	emit_imm64(e, (void*)(INTPTR_MAX >> 1));
+	emit(e, "\x4c\x39\xc0", 3);           // cmp rax, r8
+	emit_to_slow(e, "\x0f\x8d");          // jge slow
+	emit(e, "\x49\xf7\xd8", 3);           // neg r8
+	emit(e, "\x4c\x39\xc0", 3);           // cmp rax, r8
+	emit_to_slow(e, "\x0f\x8c");          // jl slow
+	emit(e, "\x48\x8d\x44\x00\x01", 5);   // lea rax, [rax + rax + 1]
+	emit(e, "\x48\x89\x41\xf0", 4);       // mov [rcx - 16], rax
+	emit(e, "\xff\x8f", 2);               // dec dword [rdi + used]
+	emit_imm32(e, offsetof(Stack, used));
+	emit_slow_path(e, helpers[op], pc, leave);
+}
+
+// a comparison fused with the JMPZ after it, which is at index i + 1
+static void emit_compare_jump(Emitter *e, Instruction *pc, V builtin, uint32_t i, uint32_t target, unsigned char *leave)
+{
+	static const char *jcc[] = {
+		[OP_LT_JMPZ - OP_LT_JMPZ] = "\x0f\x8c", // jl
+		[OP_GT_JMPZ - OP_LT_JMPZ] = "\x0f\x8f", // jg
+		[OP_LE_JMPZ - OP_LT_JMPZ] = "\x0f\x8e", // jle
+		[OP_GE_JMPZ - OP_LT_JMPZ] = "\x0f\x8d", // jge
+		[OP_EQ_JMPZ - OP_LT_JMPZ] = "\x0f\x84", // je
+	};
+	uint32_t op = BASE_OPCODE(pc->opcode);
+	int i_slow;
+	emit_int_operands(e, pc, builtin);
+	emit(e, "\x83\xaf", 2);               // sub dword [rdi + used], 2
+	emit_imm32(e, offsetof(Stack, used));
+	emit(e, "\x02", 1);
+	emit(e, "\x48\x39\xd0", 3);           // cmp rax, rdx: tagging keeps the order
+	emit_to(e, jcc[op - OP_LT_JMPZ], 2, i + 2);
+	emit_to(e, "\xe9", 1, target);
+	for (i_slow = 0; i_slow < e->n_slow; i_slow++)
+	{
+		patch_rel32(e->slow[i_slow], e->p);
+	}
+	e->n_slow = 0;
+	// the slow path pushes the result, for the JMPZ
+	emit_helper(e, helpers[op], pc, leave);
+}
+
+// the builtin pc refers to, if it still has its value
+static V builtin_of(Instruction *pc, CFuncP cfunc)
+{
+	V v = pc->cache->key == pc->literal && pc->cache->version == binding_version ? *pc->cache->slot : NULL;
+	return v != NULL && getType(v) == T_CFUNC && toCFunc(v) == cfunc ? v : NULL;
+}
+
+static FILE *perf_map = NULL;
+
+static void write_perf_map(JitCode *jc, size_t size)
+{
+	V name = lastCall;
+	int linenr = 0;
+	uint32_t i;
+	if (perf_map == NULL)
+	{
+		char fname[32];
+		sprintf(fname, "/tmp/perf-%d.map", (int)getpid());
+		if ((perf_map = fopen(fname, "w")) == NULL)
+		{
+			return;
+		}
+	}
+	for (i = 1; i < jc->length; i++)
+	{
+		if (BASE_OPCODE(jc->start[i].opcode) == OP_LINE_NUMBER)
+		{
+			linenr = jc->start[i].arg;
+			break;
+		}
+	}
+	fprintf(perf_map, "%lx %lx deja:", (unsigned long)jc->mem, (unsigned long)size);
+	if (name != NULL && getType(name) == T_IDENT)
+	{
+		fprintf(perf_map, "%.*s", (int)toIdent(name)->length, toIdent(name)->data);
+	}
+	else
+	{
+		fputs("labda", perf_map);
+	}
+	fprintf(perf_map, ":%d\n", linenr);
+	fflush(perf_map);
+}
+
+static void jit_compile(Func *fn)
+{
+	static const CFuncP builtins[256] = {
+		[OP_ADD] = add,
+		[OP_SUB] = sub,
+		[OP_MUL] = mul,
+		[OP_LT_JMPZ] = lt,
+		[OP_GT_JMPZ] = gt,
+		[OP_LE_JMPZ] = le,
+		[OP_GE_JMPZ] = ge,
+		[OP_EQ_JMPZ] = eq,
+	};
+	Instruction *code = fn->start;
+	uint32_t length = code->arg;
+	uint32_t i;
+	uint32_t target;
+	uint32_t op;
+	V builtin;
+	bool *compiled = calloc(length + 1, sizeof(bool));
+	JitCode *jc = malloc(sizeof(JitCode));
+	Emitter e;
+	unsigned char *leave;
+
+	e.n_slow = 0;
+	e.n_fixups = 0;
+	e.fixup_at = malloc(2 * length * sizeof(unsigned char*));
+	e.fixup_target = malloc(2 * length * sizeof(uint32_t));
+	// nested functions are compiled on their own
+	for (i = 1; i < length; i++)
+	{
+		compiled[i] = true;
+		if (BASE_OPCODE(code[i].opcode) == OP_LABDA || BASE_OPCODE(code[i].opcode) == OP_FLAT_LABDA)
+		{
+			i += code[i].arg - 1;
+		}
+	}
+
+	jc->start = code;
+	jc->length = length;
+	jc->entries = calloc(length, sizeof(void*));
+	jc->size = (length + 2) * MAX_TEMPLATE;
+	jc->mem = mmap(NULL, jc->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jc->mem == MAP_FAILED)
+	{
+		free(jc->entries);
+		free(jc);
+		jc = NULL;
+		goto done;
+	}
+	e.p = jc->mem;
+	jc->enter = (int (*)(JitFrame*, void*))e.p;
+	emit(&e, "\x53", 1);                  // push rbx
+	emit(&e, "\x48\x89\xfb", 3);          // mov rbx, rdi
+	emit(&e, "\xff\xe6", 2);              // jmp rsi
+	leave = e.p;
+	emit(&e, "\x5b\xc3", 2);              // pop rbx; ret
+
+	for (i = 1; i < length; i++)
+	{
+		if (!compiled[i])
+		{
+			continue;
+		}
+		jc->entries[i] = e.p;
+		op = BASE_OPCODE(code[i].opcode);
+		target = i + code[i].arg;
+		builtin = builtins[op] != NULL ? builtin_of(&code[i], builtins[op]) : NULL;
+		switch (op)
+		{
+			case OP_JMP:
+			case OP_ENTER_ERRHAND:
+				if (target < length && compiled[target])
+				{
+					emit_to(&e, "\xe9", 1, target);
+					continue;
+				}
+				break;
+			case OP_JMPZ:
+				if (target < length && compiled[target])
+				{
+					emit_call(&e, jit_jmpz, &code[i]);
+					emit(&e, "\x85\xc0", 2);  // test eax, eax
+					emit_to(&e, "\x0f\x88", 2, target); // js target
+					emit(&e, "\x0f\x85", 2);  // jnz leave
+					patch_rel32(e.p, leave);
+					e.p += 4;
+					continue;
+				}
+				break;
+			case OP_LINE_NUMBER:
+				emit_line_number(&e, &code[i]);
+				continue;
+			case OP_LEAVE_ERRHAND:
+				continue;
+			case OP_PUSH_INTEGER:
+				emit_push_integer(&e, &code[i], leave);
+				continue;
+			case OP_PUSH_SLOT:
+				emit_push_slot(&e, &code[i], jit_push_slot, leave);
+				continue;
+			case OP_GET_SLOT:
+				emit_push_slot(&e, &code[i], jit_get_slot, leave);
+				continue;
+			case OP_SET_SLOT:
+				emit_set_slot(&e, &code[i], leave);
+				continue;
+			case OP_ADD:
+			case OP_SUB:
+			case OP_MUL:
+				if (builtin != NULL)
+				{
+					emit_arithmetic(&e, &code[i], builtin, leave);
+					continue;
+				}
+				break;
+			case OP_LT_JMPZ:
+			case OP_GT_JMPZ:
+			case OP_LE_JMPZ:
+			case OP_GE_JMPZ:
+			case OP_EQ_JMPZ:
+				target = i + 1 + code[i + 1].arg;
+				if (builtin != NULL && i + 2 < length && compiled[i + 2] && target < length && compiled[target])
+				{
+					emit_compare_jump(&e, &code[i], builtin, i, target, leave);
+					continue;
+				}
+				break;
+		}
+		emit_helper(&e, op == OP_JMPZ || helpers[op] == NULL ? jit_step : helpers[op], &code[i], leave);
+	}
+	// falling off the end of the function
+	emit_call(&e, jit_stop, &code[length]);
+	emit(&e, "\xe9", 1);                  // jmp leave
+	patch_rel32(e.p, leave);
+	e.p += 4;
+
+	for (i = 0; i < e.n_fixups; i++)
+	{
+		patch_rel32(e.fixup_at[i], jc->entries[e.fixup_target[i]]);
+	}
+	mprotect(jc->mem, jc->size, PROT_READ | PROT_EXEC);
+	write_perf_map(jc, e.p - jc->mem);
+done:
+	code->frame->jit = jc;
+	free(compiled);
+	free(e.fixup_at);
+	free(e.fixup_target);
+}
+
+void jit_count_call(Func *fn)
+{
+	if (++fn->start->frame->calls == JIT_THRESHOLD)
+	{
+		jit_compile(fn);
+	}
+}
+
+bool jit_run(Stack *S, Stack *scope_arr, Scope *sc, Error *e)
+{
+	JitCode *jc = toFunc(sc->func)->start->frame->jit;
+	JitFrame frame = {S, scope_arr, get_head(scope_arr), sc, Nothing};
+	uintptr_t i;
+	if (jc == NULL)
+	{
+		return false;
+	}
+	for (;;)
+	{
+		i = sc->pc + 1 - jc->start;
+		if (i >= jc->length || jc->entries[i] == NULL)
+		{
+			return false;
+		}
+		if (jc->enter(&frame, jc->entries[i]) == JIT_EXIT)
+		{
+			*e = frame.e;
+			return true;
+		}
+	}
+}
+
+#else
+
+void jit_count_call(Func *fn)
+{
+}
+
+bool jit_run(Stack *S, Stack *scope_arr, Scope *sc, Error *e)
+{
+	return false;
+}
+
+#endif
+
+void jit_free(Frame *frame)
+{
+	JitCode *jc = frame->jit;
+	if (jc != NULL)
+	{
+		munmap(jc->mem, jc->size);
+		free(jc->entries);
+		free(jc);
+		frame->jit = NULL;
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef JIT_DEF
+#define JIT_DEF
+
+#include <stdbool.h>
+
+#include "stack.h"
+#include "scope.h"
+#include "func.h"
+#include "error.h"
+
+extern bool vm_jit;
+
+void jit_count_call(Func*);
+bool jit_run(Stack*, Stack*, Scope*, Error*);
+void jit_free(Frame*);
+
+#endif
@@ -1,6 +1,7 @@
 #include "lib.h"
 #include "utf8.h"
 #include "persist.h"
+#include "bigint.h"
 
 #include <time.h>
 #include <sys/time.h>
@@ -11,6 +12,7 @@ void print_value(V v, int depth)
 {
 	NewString* s;
 	ITreeNode* i;
+	char* digits;
 	switch (getType(v))
 	{
 		case T_IDENT:
@@ -30,6 +32,10 @@ void print_value(V v, int depth)
 			{
 				fputs("false", stdout);
 			}
+			else if (isInt(v))
+			{
+				printf("%ld", toInt(v));
+			}
 			else
 			{
 				printf("%.15g", toNumber(v));
@@ -57,14 +63,13 @@ void print_value(V v, int depth)
 				{
 					for (i = 0; i < hm->size; i++)
 					{
-						Bucket *b = hm->map[i];
-						while (b)
+						Bucket *b = &hm->map[i];
+						if (b->key != NULL)
 						{
 							putchar(' ');
 							print_value(b->key, depth + 1);
 							putchar(' ');
 							print_value(b->value, depth + 1);
-							b = b->next;
 						}
 					}
 				}
@@ -85,6 +90,16 @@ void print_value(V v, int depth)
 		case T_FRAC:
 			printf("%ld/%ld", toNumerator(v), toDenominator(v));
 			break;
+		case T_BIGINT:
+			digits = bigint_to_str(v);
+			fputs(digits, stdout);
+			free(digits);
+			break;
+		case T_BIGFRAC:
+			print_value(toBigFrac(v)->numerator, depth);
+			putchar('/');
+			print_value(toBigFrac(v)->denominator, depth);
+			break;
 		case T_CFUNC:
 			printf("<func:%p>", toCFunc(v));
 			break;
@@ -121,17 +136,11 @@ Error get(Stack* S, Stack* scope_arr)
 		clear_ref(key);
 		return TypeError;
 	}
-	Scope *sc = toScope(get_head(scope_arr));
-	V v = get_hashmap(&sc->hm, key);
-	while (v == NULL)
+	V v = lookup_name(toScope(get_head(scope_arr)), key, NULL);
+	if (v == NULL)
 	{
-		if (sc->parent == NULL)
-		{
-			clear_ref(key);
-			return NameError;
-		}
-		sc = toScope(sc->parent);
-		v = get_hashmap(&sc->hm, key);
+		clear_ref(key);
+		return NameError;
 	}
 	pushS(add_ref(v));
 	clear_ref(key);
@@ -167,20 +176,7 @@ Error set(Stack* S, Stack* scope_arr)
 		return TypeError;
 	}
 	V v = popS();
-	Scope *sc = toScope(get_head(scope_arr));
-	while (!change_hashmap(&sc->hm, key, v))
-	{
-		if (sc->parent == NULL)
-		{
-			//set in the global environment
-			set_hashmap(&sc->hm, key, v);
-			break;
-		}
-		else
-		{
-			sc = toScope(sc->parent);
-		}
-	}
+	set_name(toScope(get_head(scope_arr)), key, v);
 	clear_ref(v);
 	clear_ref(key);
 	return Nothing;
@@ -196,7 +192,7 @@ Error setglobal(Stack* S, Stack* scope_arr)
 		return TypeError;
 	}
 	V v = popS();
-	set_hashmap(&toScope(toFile(toScope(get_head(scope_arr))->file)->global)->hm, key, v);
+	set_in_scope(toScope(toFile(toScope(get_head(scope_arr))->file)->global), key, v);
 	clear_ref(v);
 	clear_ref(key);
 	return Nothing;
@@ -212,258 +208,186 @@ Error setlocal(Stack* S, Stack* scope_arr)
 		return TypeError;
 	}
 	V v = popS();
-	set_hashmap(&toScope(get_head(scope_arr))->hm, key, v);
+	set_in_scope(toScope(get_head(scope_arr)), key, v);
 	clear_ref(v);
 	clear_ref(key);
 	return Nothing;
 }
 
-Error add(Stack* S, Stack* scope_arr)
+// an integer or fraction as numerator and denominator
+static bool get_ratio(V v, frac_long *n, frac_long *d)
 {
-	require(2);
-	V r;
-	V v1 = popS();
-	V v2 = popS();
-	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
+	if (isInt(v))
 	{
-		r = double_to_value(toNumber(v1) + toNumber(v2));
+		*n = toInt(v);
+		*d = 1;
+		return true;
 	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			getNumer(v1) * getDenom(v2) +
-			getNumer(v2) * getDenom(v1),
-			getNumer(v1) * getDenom(v2)
-		);
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_NUM)
+	if (getType(v) == T_FRAC)
 	{
-		r = new_frac(
-			getNumer(v1) + toNumber(v2) * getDenom(v1),
-			getDenom(v1)
-		);
+		*n = getNumer(v);
+		*d = getDenom(v);
+		return true;
 	}
-	else if (getType(v1) == T_NUM && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			toNumber(v1) * getDenom(v2) + getNumer(v2),
-			getDenom(v2)
-		);
-	}
-	else
-	{
-		clear_ref(v1);
-		clear_ref(v2);
-		return TypeError;
-	}
-	clear_ref(v1);
-	clear_ref(v2);
-	pushS(r);
-	return Nothing;
+	return false;
 }
 
-Error sub(Stack* S, Stack* scope_arr)
+// any number, fraction or BigInt, for when it meets a double
+static bool get_real(V v, double *x)
 {
-	require(2);
-	V r;
-	V v1 = popS();
-	V v2 = popS();
-	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
+	if (getType(v) == T_NUM)
 	{
-		r = double_to_value(toNumber(v1) - toNumber(v2));
+		*x = toNumber(v);
+		return true;
 	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			getNumer(v1) * getDenom(v2) -
-			getNumer(v2) * getDenom(v1),
-			getDenom(v1) * getDenom(v2)
-		);
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_NUM)
+	if (getType(v) == T_FRAC)
 	{
-		r = new_frac(
-			getNumer(v1) - toNumber(v2) * getDenom(v1),
-			getDenom(v1)
-		);
+		*x = (double)toNumerator(v) / (double)toDenominator(v);
+		return true;
 	}
-	else if (getType(v1) == T_NUM && getType(v2) == T_FRAC)
+	if (getType(v) == T_BIGINT)
 	{
-		r = new_frac(
-			toNumber(v1) * getDenom(v2) - getNumer(v2),
-			getDenom(v2)
-		);
+		*x = bigint_to_double(v);
+		return true;
 	}
-	else
+	if (getType(v) == T_BIGFRAC)
 	{
-		clear_ref(v1);
-		clear_ref(v2);
-		return TypeError;
+		*x = rational_to_double(v);
+		return true;
 	}
-	clear_ref(v1);
-	clear_ref(v2);
-	pushS(r);
+	return false;
+}
+
+/* Arithmetic on numbers and fractions.
+ * Two tagged ints give an exact result, which becomes a BigInt if it
+ * does not fit. Two other numbers give a double. Integers and fractions
+ * give an exact result, through frac_add and frac_mul while their parts
+ * fit in a long, and through the rational_ functions once a BigInt or
+ * BigFrac is involved. A fraction or BigInt with a double gives a
+ * double.
+ */
+#define ARITHMETIC(int_case, num_case, big_case, frac_case, real_case) \
+	require(2); \
+	V r; \
+	V v1 = popS(); \
+	V v2 = popS(); \
+	frac_long n1, d1, n2, d2; \
+	double x1, x2; \
+	if (isInt(v1) && isInt(v2)) \
+	{ \
+		int_case \
+	} \
+	else if (getType(v1) == T_NUM && getType(v2) == T_NUM) \
+	{ \
+		num_case \
+	} \
+	else if (get_ratio(v1, &n1, &d1) && get_ratio(v2, &n2, &d2)) \
+	{ \
+		frac_case \
+	} \
+	else if (isRational(v1) && isRational(v2)) \
+	{ \
+		big_case \
+	} \
+	else if (get_real(v1, &x1) && get_real(v2, &x2)) \
+	{ \
+		real_case \
+	} \
+	else \
+	{ \
+		clear_ref(v1); \
+		clear_ref(v2); \
+		return TypeError; \
+	} \
+	clear_ref(v1); \
+	clear_ref(v2); \
+	pushS(r); \
 	return Nothing;
+
+#define DIVISION_BY_ZERO() \
+	{ \
+		clear_ref(v1); \
+		clear_ref(v2); \
+		error_msg = "division by zero"; \
+		return ValueError; \
+	}
+
+Error add(Stack* S, Stack* scope_arr)
+{
+	ARITHMETIC(
+		r = int_to_value(toInt(v1) + toInt(v2));,
+		r = double_to_value(toNumber(v1) + toNumber(v2));,
+		r = rational_add(v1, v2);,
+		r = frac_add(n1, d1, n2, d2);,
+		r = double_to_value(x1 + x2);
+	)
+}
+
+Error sub(Stack* S, Stack* scope_arr)
+{
+	ARITHMETIC(
+		r = int_to_value(toInt(v1) - toInt(v2));,
+		r = double_to_value(toNumber(v1) - toNumber(v2));,
+		r = rational_sub(v1, v2);,
+		r = frac_add(n1, d1, -n2, d2);,
+		r = double_to_value(x1 - x2);
+	)
 }
 
 Error mul(Stack* S, Stack* scope_arr)
 {
-	require(2);
-	V r;
-	V v1 = popS();
-	V v2 = popS();
-	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
-	{
-		r = double_to_value(toNumber(v1) * toNumber(v2));
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			getNumer(v1) * getNumer(v2),
-			getDenom(v1) * getDenom(v2)
-		);
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_NUM)
-	{
-		r = new_frac(
-			getNumer(v1) * toNumber(v2),
-			getDenom(v1)
-		);
-	}
-	else if (getType(v1) == T_NUM && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			toNumber(v1) * getNumer(v2),
-			getDenom(v2)
-		);
-	}
-	else
-	{
-		clear_ref(v1);
-		clear_ref(v2);
-		return TypeError;
-	}
-	clear_ref(v1);
-	clear_ref(v2);
-	pushS(r);
-	return Nothing;
+	ARITHMETIC(
+		r = int128_to_value((frac_long)toInt(v1) * toInt(v2));,
+		r = double_to_value(toNumber(v1) * toNumber(v2));,
+		r = rational_mul(v1, v2);,
+		r = frac_mul(n1, d1, n2, d2);,
+		r = double_to_value(x1 * x2);
+	)
 }
 
 Error div_(Stack* S, Stack* scope_arr)
 {
-	require(2);
-	V r;
-	V v1 = popS();
-	V v2 = popS();
-	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
-	{
-		if (toNumber(v2) == 0.0)
-		{
-			clear_ref(v1);
-			clear_ref(v2);
-			error_msg = "division by zero";
-			return ValueError;
-		}
-		r = double_to_value(toNumber(v1) / toNumber(v2));
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			getNumer(v1) * getDenom(v2),
-			getDenom(v1) * getNumer(v2)
-		);
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_NUM)
-	{
+	ARITHMETIC(
+		if (v2 == intToV(0))
+			DIVISION_BY_ZERO()
+		if (toInt(v1) % toInt(v2))
+			r = double_to_value((double)toInt(v1) / toInt(v2));
+		else
+			r = int_to_value(toInt(v1) / toInt(v2));,
 		if (toNumber(v2) == 0.0)
-		{
-			clear_ref(v1);
-			clear_ref(v2);
-			error_msg = "division by zero";
-			return ValueError;
-		}
-		r = new_frac(
-			getNumer(v1),
-			getDenom(v1) * toNumber(v2)
-		);
-	}
-	else if (getType(v1) == T_NUM && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			toNumber(v1) * getDenom(v2),
-			getNumer(v2)
-		);
-	}
-	else
-	{
-		clear_ref(v1);
-		clear_ref(v2);
-		return TypeError;
-	}
-	clear_ref(v1);
-	clear_ref(v2);
-	pushS(r);
-	return Nothing;
+			DIVISION_BY_ZERO()
+		r = double_to_value(toNumber(v1) / toNumber(v2));,
+		if (v2 == intToV(0))
+			DIVISION_BY_ZERO()
+		r = isInteger(v1) && isInteger(v2) ? bigint_div(v1, v2) : rational_div(v1, v2);,
+		if (n2 == 0)
+			DIVISION_BY_ZERO()
+		r = n2 < 0 ? frac_mul(n1, d1, -d2, -n2) : frac_mul(n1, d1, d2, n2);,
+		if (x2 == 0.0)
+			DIVISION_BY_ZERO()
+		r = double_to_value(x1 / x2);
+	)
 }
 
 Error mod_(Stack* S, Stack* scope_arr)
 {
-	require(2);
-	V r;
-	V v1 = popS();
-	V v2 = popS();
-	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
-	{
-		if (toNumber(v2) == 0.0)
-		{
-			clear_ref(v1);
-			clear_ref(v2);
-			error_msg = "division by zero";
-			return ValueError;
-		}
-		r = double_to_value(fmod(toNumber(v1), toNumber(v2)));
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			(getNumer(v1) * getDenom(v2)) %
-			(getNumer(v2) * getDenom(v1)),
-			getDenom(v1) * getDenom(v2)
-		);
-	}
-	else if (getType(v1) == T_FRAC && getType(v2) == T_NUM)
-	{
+	ARITHMETIC(
+		if (v2 == intToV(0))
+			DIVISION_BY_ZERO()
+		r = intToV(toInt(v1) % toInt(v2));,
 		if (toNumber(v2) == 0.0)
-		{
-			clear_ref(v1);
-			clear_ref(v2);
-			error_msg = "division by zero";
-			return ValueError;
-		}
-		r = new_frac(
-			getNumer(v1) %
-			((long int)toNumber(v2) * getDenom(v1)),
-			getDenom(v1)
-		);
-	}
-	else if (getType(v1) == T_NUM && getType(v2) == T_FRAC)
-	{
-		r = new_frac(
-			((long int)toNumber(v1) * getDenom(v2)) %
-			getNumer(v2),
-			getDenom(v2)
-		);
-	}
-	else
-	{
-		clear_ref(v1);
-		clear_ref(v2);
-		return TypeError;
-	}
-	clear_ref(v1);
-	clear_ref(v2);
-	pushS(r);
-	return Nothing;
+			DIVISION_BY_ZERO()
+		r = double_to_value(fmod(toNumber(v1), toNumber(v2)));,
+		if (v2 == intToV(0))
+			DIVISION_BY_ZERO()
+		r = rational_mod(v1, v2);,
+		if (n2 == 0)
+			DIVISION_BY_ZERO()
+		r = new_frac((n1 * d2) % (n2 * d1), d1 * d2);,
+		if (x2 == 0.0)
+			DIVISION_BY_ZERO()
+		r = double_to_value(fmod(x1, x2));
+	)
 }
 
 const char* gettype(V r)
@@ -475,6 +399,7 @@ const char* gettype(V r)
 		case T_STR:
 			return "str";
 		case T_NUM:
+		case T_BIGINT:
 			return "num";
 		case T_LIST:
 			return "list";
@@ -483,6 +408,7 @@ const char* gettype(V r)
 		case T_PAIR:
 			return "pair";
 		case T_FRAC:
+		case T_BIGFRAC:
 			return "frac";
 		case T_FUNC:
 		case T_CFUNC:
@@ -628,12 +554,36 @@ Error exit_(Stack* S, Stack* scope_arr)
 	return Exit;
 }
 
+#define isBig(x) (getType(x) == T_BIGINT || getType(x) == T_BIGFRAC)
+
+// the order of two numbers or fractions, when one of them is a BigInt or BigFrac
+static bool compare_big(V v1, V v2, int *c)
+{
+	double x1, x2;
+	if (!isBig(v1) && !isBig(v2))
+	{
+		return false;
+	}
+	if (isRational(v1) && isRational(v2))
+	{
+		*c = rational_cmp(v1, v2);
+		return true;
+	}
+	if (get_real(v1, &x1) && get_real(v2, &x2))
+	{
+		*c = (x1 > x2) - (x1 < x2);
+		return true;
+	}
+	return false;
+}
+
 Error lt(Stack* S, Stack* scope_arr)
 {
 	require(2);
 	V v1 = popS();
 	V v2 = popS();
 	__int128_t a, b;
+	int c;
 	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
 	{
 		a = (__int128_t)toNumber(v1);
@@ -654,6 +604,11 @@ Error lt(Stack* S, Stack* scope_arr)
 		a = (__int128_t)toNumber(v1) * (__int128_t)getDenom(v2);
 		b = (__int128_t)getNumer(v2);
 	}
+	else if (compare_big(v1, v2, &c))
+	{
+		a = c;
+		b = 0;
+	}
 	else
 	{
 		clear_ref(v1);
@@ -672,6 +627,7 @@ Error gt(Stack* S, Stack* scope_arr)
 	V v1 = popS();
 	V v2 = popS();
 	__int128_t a, b;
+	int c;
 	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
 	{
 		a = (__int128_t)toNumber(v1);
@@ -692,6 +648,11 @@ Error gt(Stack* S, Stack* scope_arr)
 		a = (__int128_t)toNumber(v1) * (__int128_t)getDenom(v2);
 		b = (__int128_t)getNumer(v2);
 	}
+	else if (compare_big(v1, v2, &c))
+	{
+		a = c;
+		b = 0;
+	}
 	else
 	{
 		clear_ref(v1);
@@ -710,6 +671,7 @@ Error le(Stack* S, Stack* scope_arr)
 	V v1 = popS();
 	V v2 = popS();
 	__int128_t a, b;
+	int c;
 	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
 	{
 		a = (__int128_t)toNumber(v1);
@@ -730,6 +692,11 @@ Error le(Stack* S, Stack* scope_arr)
 		a = (__int128_t)toNumber(v1) * (__int128_t)getDenom(v2);
 		b = (__int128_t)getNumer(v2);
 	}
+	else if (compare_big(v1, v2, &c))
+	{
+		a = c;
+		b = 0;
+	}
 	else
 	{
 		clear_ref(v1);
@@ -748,6 +715,7 @@ Error ge(Stack* S, Stack* scope_arr)
 	V v1 = popS();
 	V v2 = popS();
 	__int128_t a, b;
+	int c;
 	if (getType(v1) == T_NUM && getType(v2) == T_NUM)
 	{
 		a = (__int128_t)toNumber(v1);
@@ -768,6 +736,11 @@ Error ge(Stack* S, Stack* scope_arr)
 		a = (__int128_t)toNumber(v1) * (__int128_t)getDenom(v2);
 		b = (__int128_t)getNumer(v2);
 	}
+	else if (compare_big(v1, v2, &c))
+	{
+		a = c;
+		b = 0;
+	}
 	else
 	{
 		clear_ref(v1);
@@ -1004,6 +977,7 @@ Error pop_from(Stack* S, Stack* scope_arr)
 		return ValueError;
 	}
 	V val = pop(toStack(list));
+	shrink_stack(toStack(list), MIN_STACK);
 	pushS(val);
 	clear_ref(list);
 	return Nothing;
@@ -1491,10 +1465,11 @@ Error to_num(Stack *S, Stack *scope_arr)
 {
 	char *end;
 	double r;
+	V i;
 	require(1);
 	V v = popS();
 	int type = getType(v);
-	if (type == T_NUM)
+	if (type == T_NUM || type == T_BIGINT)
 	{
 		pushS(v);
 		return Nothing;
@@ -1505,11 +1480,25 @@ Error to_num(Stack *S, Stack *scope_arr)
 		clear_ref(v);
 		return Nothing;
 	}
+	else if (type == T_BIGFRAC)
+	{
+		pushS(double_to_value(rational_to_double(v)));
+		clear_ref(v);
+		return Nothing;
+	}
 	else if (type != T_STR)
 	{
 		clear_ref(v);
 		return TypeError;
 	}
+	// integers are read exactly, like integer literals
+	i = str_to_bigint(toNewString(v)->text);
+	if (i != NULL)
+	{
+		pushS(i);
+		clear_ref(v);
+		return Nothing;
+	}
 	r = strtod(toNewString(v)->text, &end);
 	clear_ref(v);
 	if (end[0] != '\0')
@@ -1530,6 +1519,14 @@ Error to_str(Stack *S, Stack *scope_arr)
 		pushS(v);
 		return Nothing;
 	}
+	else if (type == T_BIGINT)
+	{
+		char *digits = bigint_to_str(v);
+		pushS(a_to_string(digits));
+		free(digits);
+		clear_ref(v);
+		return Nothing;
+	}
 	else if (type != T_NUM)
 	{
 		clear_ref(v);
@@ -1542,7 +1539,14 @@ Error to_str(Stack *S, Stack *scope_arr)
 		return Nothing;
 	}
 	char *buff = int_str_buffer;
-	sprintf(buff, "%.15g", toNumber(v));
+	if (isInt(v))
+	{
+		sprintf(buff, "%ld", toInt(v));
+	}
+	else
+	{
+		sprintf(buff, "%.15g", toNumber(v));
+	}
 	pushS(a_to_string(buff));
 	clear_ref(v);
 	return Nothing;
@@ -1591,11 +1595,10 @@ Error keys(Stack* S, Stack* scope_arr)
 		Bucket *b;
 		for (i = 0; i < hm->size; i++)
 		{
-			b = hm->map[i];
-			while(b != NULL)
+			b = &hm->map[i];
+			if (b->key != NULL)
 			{
 				push(s, add_ref(b->key));
-				b = b->next;
 			}
 		}
 	}
@@ -1622,11 +1625,10 @@ Error values(Stack* S, Stack* scope_arr)
 		Bucket *b;
 		for (i = 0; i < hm->size; i++)
 		{
-			b = hm->map[i];
-			while(b != NULL)
+			b = &hm->map[i];
+			if (b->key != NULL)
 			{
 				push(s, add_ref(b->value));
-				b = b->next;
 			}
 		}
 	}
@@ -1654,8 +1656,8 @@ Error pairs(Stack* S, Stack* scope_arr)
 		Bucket *b;
 		for (i = 0; i < hm->size; i++)
 		{
-			b = hm->map[i];
-			while(b != NULL)
+			b = &hm->map[i];
+			if (b->key != NULL)
 			{
 				k = b->key;
 				v = b->value;
@@ -1667,7 +1669,6 @@ Error pairs(Stack* S, Stack* scope_arr)
 					return TypeError;
 				}
 				push(s, new_pair(add_ref(k), add_ref(v)));
-				b = b->next;
 			}
 		}
 	}
@@ -1686,18 +1687,12 @@ Error exists_(Stack* S, Stack* scope_arr)
 		return TypeError;
 	}
 
-	Scope *sc = toScope(get_head(scope_arr));
-	V v = get_hashmap(&sc->hm, key);
-	while (v == NULL)
+	V v = lookup_name(toScope(get_head(scope_arr)), key, NULL);
+	if (v == NULL)
 	{
-		if (sc->parent == NULL)
-		{
-			clear_ref(key);
-			pushS(add_ref(v_false));
-			return Nothing;
-		}
-		sc = toScope(sc->parent);
-		v = get_hashmap(&sc->hm, key);
+		clear_ref(key);
+		pushS(add_ref(v_false));
+		return Nothing;
 	}
 	pushS(add_ref(v_true));
 	clear_ref(key);
@@ -1708,6 +1703,11 @@ Error floor_(Stack *S, Stack *scope_arr)
 {
 	require(1);
 	V v = popS();
+	if (getType(v) == T_BIGINT)
+	{
+		pushS(v);
+		return Nothing;
+	}
 	if (getType(v) != T_NUM)
 	{
 		clear_ref(v);
@@ -1722,6 +1722,11 @@ Error ceil_(Stack *S, Stack *scope_arr)
 {
 	require(1);
 	V v = popS();
+	if (getType(v) == T_BIGINT)
+	{
+		pushS(v);
+		return Nothing;
+	}
 	if (getType(v) != T_NUM)
 	{
 		clear_ref(v);
@@ -1736,6 +1741,11 @@ Error round_(Stack *S, Stack *scope_arr)
 {
 	require(1);
 	V v = popS();
+	if (getType(v) == T_BIGINT)
+	{
+		pushS(v);
+		return Nothing;
+	}
 	if (getType(v) != T_NUM)
 	{
 		clear_ref(v);
@@ -1776,6 +1786,13 @@ Error plus_one(Stack* S, Stack* scope_arr)
 		pushS(intToV(toInt(v) + 1));
 		return Nothing;
 	}
+	else if (isInteger(v))
+	{
+		V r = bigint_add(v, intToV(1));
+		clear_ref(v);
+		pushS(r);
+		return Nothing;
+	}
 	else if (getType(v) == T_NUM)
 	{
 		V r = double_to_value(toNumber(v) + 1.0);
@@ -1799,6 +1816,13 @@ Error minus_one(Stack* S, Stack* scope_arr)
 		pushS(intToV(toInt(v) - 1));
 		return Nothing;
 	}
+	else if (isInteger(v))
+	{
+		V r = bigint_add(v, intToV(-1));
+		clear_ref(v);
+		pushS(r);
+		return Nothing;
+	}
 	else if (getType(v) == T_NUM)
 	{
 		V r = double_to_value(toNumber(v) - 1.0);
@@ -1915,7 +1939,14 @@ Error print_f(Stack* S, Stack* scope_arr)
 			printf("%*s", (int)(toNewString(v)->size), toNewString(v)->text);
 			break;
 		case T_NUM:
-			printf("%.15g", toNumber(v));
+			if (isInt(v))
+			{
+				printf("%ld", toInt(v));
+			}
+			else
+			{
+				printf("%.15g", toNumber(v));
+			}
 			break;
 		default:
 			print_value(v, 1);
@@ -1961,6 +1992,12 @@ Error abs_(Stack *S, Stack *scope_arr)
 {
 	require(1);
 	V v = popS();
+	if (getType(v) == T_BIGINT)
+	{
+		pushS(toBigInt(v)->sign < 0 ? bigint_neg(v) : add_ref(v));
+		clear_ref(v);
+		return Nothing;
+	}
 	if (getType(v) != T_NUM)
 	{
 		clear_ref(v);
@@ -2067,23 +2104,84 @@ Error print_ident_depth(Stack *S, Stack *scope_arr)
 	return Nothing;
 }
 
+Error print_dict_stats(Stack *S, Stack *scope_arr)
+{
+	require(1);
+	V v = popS();
+	unsigned long total;
+	int longest;
+	if (getType(v) != T_DICT)
+	{
+		clear_ref(v);
+		return TypeError;
+	}
+	HashMap *hm = toHashMap(v);
+	hashmap_probes(hm, &total, &longest);
+	printf("(dict-stats:used %d, size %d, mean probes %.2f, longest %d)\n",
+		hm->used, hm->size, hm->used ? (double)total / hm->used : 0.0, longest);
+	clear_ref(v);
+	return Nothing;
+}
+
+static void set_stat(V dict, const char* name, V value)
+{
+	set_hashmap(toHashMap(dict), get_ident(name), value);
+	clear_ref(value);
+}
+
+Error gc_stats_(Stack *S, Stack *scope_arr)
+{
+	int i;
+	V v = new_dict();
+	V allocs = new_dict();
+	V frees = new_dict();
+	for (i = 0; i < N_VALUE_TYPES; i++)
+	{
+		if (value_type_name(i) != NULL)
+		{
+			set_stat(allocs, value_type_name(i), int_to_value(gc_stats.allocs[i]));
+			set_stat(frees, value_type_name(i), int_to_value(gc_stats.frees[i]));
+		}
+	}
+	set_stat(v, "allocs", allocs);
+	set_stat(v, "frees", frees);
+	set_stat(v, "collections", int_to_value(gc_stats.collections));
+	set_stat(v, "roots-buffered", int_to_value(gc_stats.roots_buffered));
+	set_stat(v, "cycles-reclaimed", int_to_value(gc_stats.cycles_reclaimed));
+	set_stat(v, "mark-time", double_to_value(gc_stats.mark_time));
+	set_stat(v, "scan-time", double_to_value(gc_stats.scan_time));
+	set_stat(v, "collect-time", double_to_value(gc_stats.collect_time));
+	set_stat(v, "live-bytes", int_to_value(gc_stats.live_bytes));
+	set_stat(v, "peak-bytes", int_to_value(gc_stats.peak_bytes));
+	pushS(v);
+	return Nothing;
+}
+
 Error make_frac(Stack* S, Stack* scope_arr)
 {
 	require(2);
 	V n = popS();
 	V d = popS();
-	if (!isInt(n) || !isInt(d))
+	if (!isInteger(n) || !isInteger(d))
 	{
 		clear_ref(n);
 		clear_ref(d);
 		return TypeError;
 	}
-	if (toInt(d) == 0)
+	if (d == intToV(0))
 	{
+		clear_ref(n);
 		error_msg = "division by zero";
 		return ValueError;
 	}
-	pushS(new_frac(toInt(n), toInt(d)));
+	if (isInt(n) && isInt(d))
+	{
+		pushS(new_frac(toInt(n), toInt(d)));
+		return Nothing;
+	}
+	pushS(ratio_to_value(n, d));
+	clear_ref(n);
+	clear_ref(d);
 	return Nothing;
 }
 
@@ -2204,6 +2302,10 @@ Error chance(Stack *S, Stack *scope_arr)
 	{
 		threshold = toNumerator(p) * RAND_MAX / toDenominator(p);
 	}
+	else if (getType(p) == T_BIGFRAC)
+	{
+		threshold = rational_to_double(p) * RAND_MAX;
+	}
 	else
 	{
 		clear_ref(p);
@@ -2336,6 +2438,8 @@ static CFunc stdlib[] = {
 	{"atan", atan_},
 	{"(ident-count)", print_ident_count},
 	{"(ident-depth)", print_ident_depth},
+	{"(dict-stats)", print_dict_stats},
+	{"(gc-stats)", gc_stats_},
 	{"//", make_frac},
 	{"clear", clear},
 	{"time", time_},
@@ -2362,6 +2466,19 @@ static CFunc stdlib[] = {
 	{NULL, NULL}
 };
 
+const char* cfunc_name(CFuncP f)
+{
+	int i;
+	for (i = 0; stdlib[i].name != NULL; i++)
+	{
+		if (stdlib[i].cfunc == f)
+		{
+			return stdlib[i].name;
+		}
+	}
+	return NULL;
+}
+
 static char* autonyms[] = {"(", ")", "]", "}", NULL};
 
 void open_lib(CFunc lib[], HashMap* hm)
@@ -2374,6 +2491,8 @@ void open_lib(CFunc lib[], HashMap* hm)
 		clear_ref(v);
 		i++;
 	}
+	//invalidate inline caches
+	binding_version++;
 }
 
 void open_std_lib(HashMap* hm)
@@ -2385,10 +2504,8 @@ void open_std_lib(HashMap* hm)
 		V j = get_ident(*k);
 		set_hashmap(hm, j, j);
 	}
-	v_true = make_new_value(T_NUM, true, sizeof(double));
-	toDouble(v_true) = 1.0;
-	v_false = make_new_value(T_NUM, true, sizeof(double));
-	toDouble(v_false) = 0.0;
+	v_true = boolToV(true);
+	v_false = boolToV(false);
 	v_range = new_cfunc(range);
 	set_hashmap(hm, get_ident("true"), v_true);
 	set_hashmap(hm, get_ident("false"), v_false);
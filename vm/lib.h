@@ -21,6 +21,7 @@ typedef struct
 } CFunc;
 
 V new_cfunc(CFuncP);
+const char* cfunc_name(CFuncP);
 V v_true;
 V v_false;
 void open_lib(CFunc[], HashMap*);
@@ -29,6 +30,14 @@ void open_std_lib(HashMap*);
 #define require(x) if (stack_size(S) < (x)) return StackEmpty;
 
 Error return_(Stack*, Stack*);
+Error add(Stack*, Stack*);
+Error sub(Stack*, Stack*);
+Error mul(Stack*, Stack*);
+Error lt(Stack*, Stack*);
+Error gt(Stack*, Stack*);
+Error le(Stack*, Stack*);
+Error ge(Stack*, Stack*);
+Error eq(Stack*, Stack*);
 void print_value(V, int);
 
 #endif
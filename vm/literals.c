@@ -1,6 +1,8 @@
 #include "literals.h"
 #include "idents.h"
 #include "strings.h"
+#include "bigint.h"
+#include "gc.h"
 
 #include <stdlib.h>
 #include <sys/types.h>
@@ -13,6 +15,27 @@ uint64_t ntohll_(uint64_t i)
 	return ntohl(i >> 32) | ((uint64_t)ntohl(i & (((uint64_t)1 << 32) - 1)) << 32);
 }
 
+// a limb count, a sign and the limbs, as after TYPE_BIGINT
+static V read_bigint(char **pos)
+{
+	char *curpos = *pos;
+	uint32_t n, limb, j;
+	int8_t sign;
+	memcpy(&n, curpos, 4);
+	n = ntohl(n);
+	sign = curpos[4];
+	curpos += 5;
+	uint32_t limbs[n + 1];
+	for (j = 0; j < n; j++)
+	{
+		memcpy(&limb, curpos, 4);
+		limbs[j] = ntohl(limb);
+		curpos += 4;
+	}
+	*pos = curpos;
+	return limbs_to_value(sign, limbs, n);
+}
+
 bool read_literals(char *oldpos, size_t size, Header* h)
 {
 	int i, j;
@@ -57,6 +80,16 @@ bool read_literals(char *oldpos, size_t size, Header* h)
 			case TYPE_FRAC | TYPE_SHORT:
 				curpos += 2;
 				break;
+			case TYPE_BIGINT:
+				memcpy(&str_length, curpos, 4);
+				curpos += 5 + 4 * ntohl(str_length);
+				break;
+			case TYPE_BIGFRAC:
+				memcpy(&str_length, curpos, 4);
+				curpos += 5 + 4 * ntohl(str_length);
+				memcpy(&str_length, curpos, 4);
+				curpos += 5 + 4 * ntohl(str_length);
+				break;
 			case TYPE_LIST:
 				memcpy(&str_length, curpos, 4);
 				curpos += 4 + 3 * ntohl(str_length);
@@ -177,6 +210,18 @@ bool read_literals(char *oldpos, size_t size, Header* h)
 			denom = *curpos++;
 			t = new_frac(numer, denom);
 		}
+		else if (type == TYPE_BIGINT)
+		{
+			t = read_bigint(&curpos);
+		}
+		else if (type == TYPE_BIGFRAC)
+		{
+			V numer = read_bigint(&curpos);
+			V denom = read_bigint(&curpos);
+			t = ratio_to_value(numer, denom);
+			clear_ref(numer);
+			clear_ref(denom);
+		}
 		else if (type == TYPE_LIST)
 		{
 			memcpy(&str_length, curpos, 4);
@@ -212,7 +257,7 @@ bool read_literals(char *oldpos, size_t size, Header* h)
 				while (size < str_length) size <<= 1;
 				toHashMap(t)->size = size;
 				toHashMap(t)->used = str_length;
-				toHashMap(t)->map = (Bucket**)curpos;
+				toHashMap(t)->map = (Bucket*)curpos;
 			}
 			curpos += 6 * str_length;
 		}
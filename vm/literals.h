@@ -15,6 +15,8 @@
 #define TYPE_DICT '\x05'
 #define TYPE_PAIR '\x06'
 #define TYPE_FRAC '\x07'
+#define TYPE_BIGINT '\x08'
+#define TYPE_BIGFRAC '\x09'
 // not a type, a flag for
 // short variants of other
 // types
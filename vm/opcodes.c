@@ -1,513 +1,870 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <netinet/in.h>
 
 #include "types.h"
 #include "literals.h"
 #include "lib.h"
+#include "profile.h"
+#include "jit.h"
 
 extern V lastCall;
+extern bool reraise;
 
-Error inline do_instruction(Header* h, Stack* S, Stack* scope_arr)
+#ifdef __GNUC__
+#define THREADED
+#endif
+
+/* The interpreter core.
+ * Instead of being called once per instruction, do_instructions keeps
+ * the program counter and the current scope in locals, and only
+ * returns when the scope stack changes or an error is raised. run()
+ * then picks up the new head of the scope stack.
+ * The code was decoded by load_memfile, so arguments are already
+ * sign extended and literals resolved.
+ *
+ * When compiled with GCC, dispatch is direct-threaded (computed goto):
+ * every instruction jumps straight to the handler of the next one.
+ * Other compilers fall back to a switch in a loop.
+ * When profiling or counting opcodes, dispatch goes through
+ * profile_table instead, which sends every instruction to the
+ * profiler before its handler. step_instruction uses the same table
+ * to stop before the second instruction.
+ */
+
+static bool single_step = false;
+
+#define ARG (pc->arg)
+#define LITERAL (pc->literal)
+
+// resolve a name through the inline cache of the current instruction
+#define LOOKUP(k) \
+	if (pc->cache->key == (k) && pc->cache->version == binding_version) \
+	{ \
+		v = *pc->cache->slot; \
+	} \
+	else \
+	{ \
+		v = lookup_name(sc, (k), pc->cache); \
+	}
+
+// resolve a name that lives in a slot of the current function
+#define SLOT_LOOKUP() \
+	if (sc->slots == NULL || (v = sc->slots[ARG]) == NULL) \
+	{ \
+		v = lookup_slot(sc, LITERAL, ARG); \
+	}
+
+/* Quickening.
+ * Once PUSH_WORD has resolved its word through the inline cache, it
+ * rewrites itself into PUSH_WORD_CFUNC, PUSH_WORD_FUNC or
+ * PUSH_WORD_VALUE, which skip the lookup and the type dispatch. They
+ * stay valid as long as the cache does: binding_version also changes
+ * whenever a cached binding changes to or from a function.
+ * Otherwise they turn back into PUSH_WORD.
+ */
+#define QUICK_GUARD() \
+	lastCall = LITERAL; \
+	if (pc->cache->version != binding_version) \
+	{ \
+		pc->opcode = OP_PUSH_WORD; \
+		goto push_word_generic; \
+	}
+
+/* Tail calls.
+ * TAILCALL is a PUSH_WORD that the compiler found in tail position.
+ * If its word is a function, the scopes of the current function are
+ * dropped before the call, so the new function scope replaces them
+ * instead of going on top. That is not possible outside of functions
+ * or inside the body of a try; then it is a normal call,
+ * and the instructions after it return as usual.
+ */
+static bool can_drop_frame(Stack* scope_arr, Instruction* pc)
+{
+	int i;
+	Scope* sc;
+	V file = toScope(get_head(scope_arr))->file;
+	for (i = stack_size(scope_arr) - 1; i >= 0; i--)
+	{
+		sc = toScope(scope_arr->nodes[i]);
+		if (sc->file == file && find_handler(file, i == stack_size(scope_arr) - 1 ? pc : sc->pc) != NULL)
+		{
+			return false;
+		}
+		if (sc->is_func_scope || sc->file != file)
+		{
+			return sc->is_func_scope && sc->func != NULL && sc->file == file;
+		}
+	}
+	return false;
+}
+
+/* Arithmetic and comparisons.
+ * These are the words + - * < > <= >= =, compiled to opcodes of
+ * their own. As long as the word still means the builtin, two tagged
+ * ints are handled here; anything else goes to the builtin. If the
+ * word has been rebound, the instruction acts like PUSH_WORD.
+ */
+#define BINARY_OP(cfunc, int_case) \
+	lastCall = key = LITERAL; \
+	LOOKUP(key); \
+	if (v == NULL || getType(v) != T_CFUNC || toCFunc(v) != (cfunc)) \
+	{ \
+		goto push_word; \
+	} \
+	if (stack_size(S) >= 2 && isInt(S->nodes[S->used - 1]) && isInt(S->nodes[S->used - 2])) \
+	{ \
+		long int a = toInt(S->nodes[S->used - 1]); \
+		long int b = toInt(S->nodes[S->used - 2]); \
+		int_case \
+	} \
+	CALL_CFUNC(cfunc); \
+	NEXT();
+
+// replace the two operands by r, unless it does not fit in a tagged int
+#define INT_RESULT(r) \
+	if (canBeInt(r)) \
+	{ \
+		S->used--; \
+		S->nodes[S->used - 1] = intToV(r); \
+		NEXT(); \
+	}
+
+#define BOOL_RESULT(c) \
+	S->used -= 2; \
+	pushS(add_ref((c) ? v_true : v_false)); \
+	NEXT();
+
+/* Superinstructions.
+ * The compiler replaces the first instruction of some common pairs by
+ * a fused opcode, but leaves the second one in place. The fused
+ * opcode does the work of both and skips the second instruction,
+ * unless it has to fall back to doing only the work of the first.
+ * Jumps to the second instruction keep working as well.
+ */
+// for comparisons followed by JMPZ
+#define JUMP_UNLESS(c) \
+	S->used -= 2; \
+	pc += (c) ? 1 : pc[1].arg; \
+	NEXT();
+
+#define FETCH() ++pc
+// the verifier dispatches to UNCHECKED(op) where it proved n values are there
+#ifdef THREADED
+#define TARGET(op) L_##op:
+#define CHECKED_TARGET(op, n) L_##op: REQUIRE(n); L_##op##_UNCHECKED:
+#define NEXT() FETCH(); goto *table[pc->opcode]
+#else
+#define TARGET(op) case op:
+#define CHECKED_TARGET(op, n) case op: REQUIRE(n); case UNCHECKED(op):
+#define NEXT() FETCH(); goto dispatch
+#endif
+
+// save the program counter before anything can look at the scope stack
+#define SAVE_PC() sc->pc = pc
+// leave after the scope stack has changed
+#define LEAVE() return Nothing
+#define RAISE(e) { sc->pc = pc; lastCall = NULL; return e; }
+#define REQUIRE(n) if (stack_size(S) < (n)) RAISE(StackEmpty)
+// CFuncs can do anything to the scope stack, so reload all locals
+#define CALL_CFUNC(f) \
+	SAVE_PC(); \
+	if (vm_profile) \
+	{ \
+		profile_cfunc(f); \
+	} \
+	e = (f)(S, scope_arr); \
+	if (e != Nothing) \
+	{ \
+		return e; \
+	} \
+	if (get_head(scope_arr) != scope) \
+	{ \
+		LEAVE(); \
+	} \
+	pc = sc->pc;
+
+Error do_instructions(Stack* S, Stack* scope_arr)
 {
 	V container;
 	V v;
 	V key;
 	V scope = get_head(scope_arr);
 	Scope *sc = toScope(scope);
+	Instruction *pc = sc->pc;
 	V file;
 	bool t;
-	uint32_t *pc;
-	int argument;
-	unsigned int instruction = ntohl(*sc->pc);
-	int opcode = instruction >> 24;
-	lastCall = NULL;
-	switch (opcode)
+	Error e;
+	bool step = single_step;
+	bool stepped = false;
+#ifdef THREADED
+	static void *dispatch_table[512] = {
+		[0 ... 511] = &&L_OP_UNKNOWN,
+		[OP_PUSH_LITERAL] = &&L_OP_PUSH_LITERAL,
+		[OP_PUSH_INTEGER] = &&L_OP_PUSH_INTEGER,
+		[OP_PUSH_WORD] = &&L_OP_PUSH_WORD,
+		[OP_SET] = &&L_OP_SET,
+		[OP_SET_LOCAL] = &&L_OP_SET_LOCAL,
+		[OP_SET_GLOBAL] = &&L_OP_SET_GLOBAL,
+		[OP_GET] = &&L_OP_GET,
+		[OP_GET_GLOBAL] = &&L_OP_GET_GLOBAL,
+		[OP_PUSH_SLOT] = &&L_OP_PUSH_SLOT,
+		[OP_SET_SLOT] = &&L_OP_SET_SLOT,
+		[OP_SET_LOCAL_SLOT] = &&L_OP_SET_LOCAL_SLOT,
+		[OP_GET_SLOT] = &&L_OP_GET_SLOT,
+		[OP_JMP] = &&L_OP_JMP,
+		[OP_JMPZ] = &&L_OP_JMPZ,
+		[OP_RETURN] = &&L_OP_RETURN,
+		[OP_RECURSE] = &&L_OP_RECURSE,
+		[OP_JMPEQ] = &&L_OP_JMPEQ,
+		[OP_JMPNE] = &&L_OP_JMPNE,
+		[OP_TAILCALL] = &&L_OP_TAILCALL,
+		[OP_LABDA] = &&L_OP_LABDA,
+		[OP_FLAT_LABDA] = &&L_OP_FLAT_LABDA,
+		[OP_CAPTURE] = &&L_OP_CAPTURE,
+		[OP_ENTER_SCOPE] = &&L_OP_ENTER_SCOPE,
+		[OP_LEAVE_SCOPE] = &&L_OP_LEAVE_SCOPE,
+		[OP_NEW_LIST] = &&L_OP_NEW_LIST,
+		[OP_POP_FROM] = &&L_OP_POP_FROM,
+		[OP_PUSH_TO] = &&L_OP_PUSH_TO,
+		[OP_PUSH_THROUGH] = &&L_OP_PUSH_THROUGH,
+		[OP_DROP] = &&L_OP_DROP,
+		[OP_DUP] = &&L_OP_DUP,
+		[OP_SWAP] = &&L_OP_SWAP,
+		[OP_ROT] = &&L_OP_ROT,
+		[OP_OVER] = &&L_OP_OVER,
+		[OP_LINE_NUMBER] = &&L_OP_LINE_NUMBER,
+		[OP_SOURCE_FILE] = &&L_OP_SOURCE_FILE,
+		[OP_ENTER_ERRHAND] = &&L_OP_ENTER_ERRHAND,
+		[OP_LEAVE_ERRHAND] = &&L_OP_LEAVE_ERRHAND,
+		[OP_RAISE] = &&L_OP_RAISE,
+		[OP_RERAISE] = &&L_OP_RERAISE,
+		[OP_NEW_DICT] = &&L_OP_NEW_DICT,
+		[OP_HAS_DICT] = &&L_OP_HAS_DICT,
+		[OP_GET_DICT] = &&L_OP_GET_DICT,
+		[OP_SET_DICT] = &&L_OP_SET_DICT,
+		[OP_CALL] = &&L_OP_CALL,
+		[OP_ADD] = &&L_OP_ADD,
+		[OP_SUB] = &&L_OP_SUB,
+		[OP_MUL] = &&L_OP_MUL,
+		[OP_LT] = &&L_OP_LT,
+		[OP_GT] = &&L_OP_GT,
+		[OP_LE] = &&L_OP_LE,
+		[OP_GE] = &&L_OP_GE,
+		[OP_EQ] = &&L_OP_EQ,
+		[OP_DUP_JMPZ] = &&L_OP_DUP_JMPZ,
+		[OP_LEAVE_SCOPE_JMP] = &&L_OP_LEAVE_SCOPE_JMP,
+		[OP_LT_JMPZ] = &&L_OP_LT_JMPZ,
+		[OP_GT_JMPZ] = &&L_OP_GT_JMPZ,
+		[OP_LE_JMPZ] = &&L_OP_LE_JMPZ,
+		[OP_GE_JMPZ] = &&L_OP_GE_JMPZ,
+		[OP_EQ_JMPZ] = &&L_OP_EQ_JMPZ,
+		[OP_PUSH_WORD_CFUNC] = &&L_OP_PUSH_WORD_CFUNC,
+		[OP_PUSH_WORD_FUNC] = &&L_OP_PUSH_WORD_FUNC,
+		[OP_PUSH_WORD_VALUE] = &&L_OP_PUSH_WORD_VALUE,
+		[UNCHECKED(OP_SET)] = &&L_OP_SET_UNCHECKED,
+		[UNCHECKED(OP_SET_LOCAL)] = &&L_OP_SET_LOCAL_UNCHECKED,
+		[UNCHECKED(OP_SET_GLOBAL)] = &&L_OP_SET_GLOBAL_UNCHECKED,
+		[UNCHECKED(OP_SET_SLOT)] = &&L_OP_SET_SLOT_UNCHECKED,
+		[UNCHECKED(OP_SET_LOCAL_SLOT)] = &&L_OP_SET_LOCAL_SLOT_UNCHECKED,
+		[UNCHECKED(OP_JMPZ)] = &&L_OP_JMPZ_UNCHECKED,
+		[UNCHECKED(OP_JMPEQ)] = &&L_OP_JMPEQ_UNCHECKED,
+		[UNCHECKED(OP_JMPNE)] = &&L_OP_JMPNE_UNCHECKED,
+		[UNCHECKED(OP_POP_FROM)] = &&L_OP_POP_FROM_UNCHECKED,
+		[UNCHECKED(OP_PUSH_TO)] = &&L_OP_PUSH_TO_UNCHECKED,
+		[UNCHECKED(OP_PUSH_THROUGH)] = &&L_OP_PUSH_THROUGH_UNCHECKED,
+		[UNCHECKED(OP_DROP)] = &&L_OP_DROP_UNCHECKED,
+		[UNCHECKED(OP_DUP)] = &&L_OP_DUP_UNCHECKED,
+		[UNCHECKED(OP_SWAP)] = &&L_OP_SWAP_UNCHECKED,
+		[UNCHECKED(OP_ROT)] = &&L_OP_ROT_UNCHECKED,
+		[UNCHECKED(OP_OVER)] = &&L_OP_OVER_UNCHECKED,
+		[UNCHECKED(OP_RAISE)] = &&L_OP_RAISE_UNCHECKED,
+		[UNCHECKED(OP_RERAISE)] = &&L_OP_RERAISE_UNCHECKED,
+		[UNCHECKED(OP_HAS_DICT)] = &&L_OP_HAS_DICT_UNCHECKED,
+		[UNCHECKED(OP_GET_DICT)] = &&L_OP_GET_DICT_UNCHECKED,
+		[UNCHECKED(OP_SET_DICT)] = &&L_OP_SET_DICT_UNCHECKED,
+		[UNCHECKED(OP_CALL)] = &&L_OP_CALL_UNCHECKED,
+		[UNCHECKED(OP_DUP_JMPZ)] = &&L_OP_DUP_JMPZ_UNCHECKED,
+	};
+	static void *profile_table[512] = {
+		[0 ... 511] = &&L_PROFILE,
+	};
+	void **table = vm_profile || vm_opcode_stats || step ? profile_table : dispatch_table;
+#endif
+
+	single_step = false;
+	if (vm_jit && !step && sc->func != NULL)
 	{
-		case OP_PUSH_INTEGER:
-		case OP_JMP:
-		case OP_JMPZ:
-		case OP_JMPEQ:
-		case OP_JMPNE:
-			argument = instruction & 8388607;
-			if (instruction & (1 << 23))
-			{
-				argument = -(~argument & 8388607) - 1;
-			}
-			break;
-		default:
-			argument = instruction & 16777215;
+		if (jit_run(S, scope_arr, sc, &e))
+		{
+			return e;
+		}
+		pc = sc->pc;
 	}
-	switch (opcode)
+	NEXT();
+#ifdef THREADED
+L_PROFILE:
+	if (step)
 	{
-		case OP_PUSH_LITERAL:
-			pushS(add_ref(get_literal(h, argument)));
-			break;
-		case OP_PUSH_INTEGER:
-			pushS(int_to_value(argument));
-			break;
-		case OP_PUSH_WORD:
-			lastCall = key = get_literal(h, argument);
-			v = get_hashmap(&sc->hm, key);
-			while (v == NULL)
-			{
-				if (sc->parent == NULL)
-				{
-					return NameError;
-				}
-				sc = toScope(sc->parent);
-				v = get_hashmap(&sc->hm, key);
-			}
-			if (getType(v) == T_FUNC)
-			{
-				push(scope_arr, add_rooted(new_function_scope(v)));
-			}
-			else if (getType(v) == T_CFUNC)
-			{
-				return toCFunc(v)(S, scope_arr);
-			}
-			else
-			{
-				pushS(add_ref(v));
-			}
-			break;
-		case OP_SET:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			V key = get_literal(h, argument);
-			while (!change_hashmap(&sc->hm, key, v))
-			{
-				if (sc->parent == NULL)
-				{
-					//set in the global environment
-					set_hashmap(&sc->hm, key, v);
-					break;
-				}
-				else
-				{
-					sc = toScope(sc->parent);
-				}
-			}
-			clear_ref(v);
-			break;
-		case OP_SET_LOCAL:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			set_hashmap(&sc->hm, get_literal(h, argument), v);
+		if (stepped)
+		{
+			sc->pc = pc - 1;
+			return Nothing;
+		}
+		stepped = true;
+	}
+	if (vm_profile)
+	{
+		profile_instruction(sc);
+	}
+	if (vm_opcode_stats)
+	{
+		count_opcode(pc);
+	}
+	goto *dispatch_table[pc->opcode];
+#else
+dispatch:
+	if (step)
+	{
+		if (stepped)
+		{
+			sc->pc = pc - 1;
+			return Nothing;
+		}
+		stepped = true;
+	}
+	if (vm_profile)
+	{
+		profile_instruction(sc);
+	}
+	if (vm_opcode_stats)
+	{
+		count_opcode(pc);
+	}
+	switch (pc->opcode)
+	{
+#endif
+	TARGET(OP_PUSH_LITERAL)
+		pushS(add_ref(LITERAL));
+		NEXT();
+	TARGET(OP_PUSH_INTEGER)
+		pushS(int_to_value(ARG));
+		NEXT();
+	TARGET(OP_PUSH_WORD)
+	push_word_generic:
+		lastCall = key = LITERAL;
+		LOOKUP(key);
+		if (v != NULL && pc->cache->key == key && pc->cache->version == binding_version)
+		{
+			pc->cache->value = v;
+			pc->opcode = getType(v) == T_CFUNC ? OP_PUSH_WORD_CFUNC :
+				getType(v) == T_FUNC ? OP_PUSH_WORD_FUNC : OP_PUSH_WORD_VALUE;
+		}
+	push_word:
+		if (v == NULL)
+		{
+			SAVE_PC();
+			return NameError;
+		}
+		if (getType(v) == T_FUNC)
+		{
+			SAVE_PC();
+			push(scope_arr, add_rooted(new_function_scope(v)));
+			LEAVE();
+		}
+		else if (getType(v) == T_CFUNC)
+		{
+			CALL_CFUNC(toCFunc(v));
+		}
+		else
+		{
+			pushS(add_ref(v));
+		}
+		NEXT();
+	TARGET(OP_PUSH_WORD_CFUNC)
+		QUICK_GUARD();
+		CALL_CFUNC(toCFunc(pc->cache->value));
+		NEXT();
+	TARGET(OP_PUSH_WORD_FUNC)
+		QUICK_GUARD();
+		SAVE_PC();
+		push(scope_arr, add_rooted(new_function_scope(pc->cache->value)));
+		LEAVE();
+	TARGET(OP_PUSH_WORD_VALUE)
+		QUICK_GUARD();
+		pushS(add_ref(*pc->cache->slot));
+		NEXT();
+	CHECKED_TARGET(OP_SET, 1)
+		v = popS();
+		set_name(sc, LITERAL, v);
+		clear_ref(v);
+		NEXT();
+	CHECKED_TARGET(OP_SET_LOCAL, 1)
+		v = popS();
+		set_in_scope(sc, LITERAL, v);
+		clear_ref(v);
+		NEXT();
+	CHECKED_TARGET(OP_SET_GLOBAL, 1)
+		v = popS();
+		set_in_scope(toScope(toFile(sc->file)->global), LITERAL, v);
+		clear_ref(v);
+		NEXT();
+	TARGET(OP_GET)
+		LOOKUP(LITERAL);
+		if (v == NULL)
+		{
+			RAISE(NameError);
+		}
+		pushS(add_ref(v));
+		NEXT();
+	TARGET(OP_GET_GLOBAL)
+		v = get_hashmap(&toScope(toFile(sc->file)->global)->hm, LITERAL);
+		if (v == NULL)
+		{
+			RAISE(NameError);
+		}
+		pushS(add_ref(v));
+		NEXT();
+	TARGET(OP_PUSH_SLOT)
+		lastCall = LITERAL;
+		SLOT_LOOKUP();
+		goto push_word;
+	CHECKED_TARGET(OP_SET_SLOT, 1)
+		v = popS();
+		if (sc->slots != NULL && sc->slots[ARG] != NULL)
+		{
+			key = sc->slots[ARG]; //variable reuse
+			sc->slots[ARG] = v;
+			clear_ref(key);
+		}
+		else
+		{
+			set_slot(sc, LITERAL, ARG, v);
 			clear_ref(v);
-			break;
-		case OP_SET_GLOBAL:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			set_hashmap(&toScope(toFile(sc->file)->global)->hm, get_literal(h, argument), v);
+		}
+		NEXT();
+	CHECKED_TARGET(OP_SET_LOCAL_SLOT, 1)
+		v = popS();
+		if (sc->slots != NULL)
+		{
+			key = sc->slots[ARG]; //variable reuse
+			sc->slots[ARG] = v;
+			clear_ref(key);
+		}
+		else
+		{
+			set_in_scope(sc, LITERAL, v);
 			clear_ref(v);
-			break;
-		case OP_GET:
-			key = get_literal(h, argument);
-			v = get_hashmap(&sc->hm, key);
-			while (v == NULL)
-			{
-				if (sc->parent == NULL)
-				{
-					return NameError;
-				}
-				sc = toScope(sc->parent);
-				v = get_hashmap(&sc->hm, key);
-			}
-			pushS(add_ref(v));
-			break;
-		case OP_GET_GLOBAL:
-			v = get_hashmap(&toScope(toFile(sc->file)->global)->hm, get_literal(h, argument));
+		}
+		NEXT();
+	TARGET(OP_GET_SLOT)
+		SLOT_LOOKUP();
+		if (v == NULL)
+		{
+			RAISE(NameError);
+		}
+		pushS(add_ref(v));
+		NEXT();
+	TARGET(OP_JMP)
+		pc += ARG - 1;
+		NEXT();
+	CHECKED_TARGET(OP_JMPZ, 1)
+		v = popS();
+		t = truthy(v);
+		clear_ref(v);
+		if (!t)
+		{
+			pc += ARG - 1;
+		}
+		NEXT();
+	TARGET(OP_RETURN)
+		v = NULL;
+		file = sc->file;
+		do
+		{
+			clear_base_ref(v);
+			v = pop(scope_arr);
 			if (v == NULL)
 			{
-				return NameError;
-			}
-			pushS(add_ref(v));
-			break;
-		case OP_JMP:
-			sc->pc += argument - 1;
-			break;
-		case OP_JMPZ:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			t = truthy(v);
-			clear_ref(v);
-			if (!t)
-			{
-				sc->pc += argument - 1;
-			}
-			break;
-		case OP_RETURN:
-			v = NULL;
-			file = sc->file;
-			do
-			{
-				clear_base_ref(v);
-				v = pop(scope_arr);
-				if (v == NULL)
-				{
-					return Exit;
-				}
+				return Exit;
 			}
-			while (!toScope(v)->is_func_scope && toScope(v)->file == file);
+		}
+		while (!toScope(v)->is_func_scope && toScope(v)->file == file);
+		clear_base_ref(v);
+		if (stack_size(scope_arr) == 0)
+		{
+			return Exit;
+		}
+		LEAVE();
+	TARGET(OP_TAILCALL)
+		lastCall = key = LITERAL;
+		LOOKUP(key);
+		if (v == NULL || getType(v) != T_FUNC || !can_drop_frame(scope_arr, pc))
+		{
+			goto push_word;
+		}
+		add_ref(v);
+		key = NULL; //variable reuse
+		do
+		{
+			clear_base_ref(key);
+			key = pop(scope_arr);
+		}
+		while (!toScope(key)->is_func_scope);
+		clear_base_ref(key);
+		key = new_function_scope(v);
+		toScope(key)->is_tail_call = true;
+		push(scope_arr, add_rooted(key));
+		clear_ref(v);
+		LEAVE();
+	TARGET(OP_RECURSE)
+		v = NULL;
+		file = sc->file;
+		do
+		{
 			clear_base_ref(v);
-			if (stack_size(scope_arr) == 0)
+			v = pop(scope_arr);
+			if (v == NULL)
 			{
 				return Exit;
 			}
-			break;
-		case OP_RECURSE:
-			v = NULL;
-			file = sc->file;
-			do
-			{
-				clear_base_ref(v);
-				v = pop(scope_arr);
-				if (v == NULL)
-				{
-					return Exit;
-				}
-			}
-			while (!toScope(v)->is_func_scope && toScope(v)->file == file);
-			push(scope_arr, add_rooted(v));
-			sc = toScope(v);
-			sc->pc = toFunc(sc->func)->start;
-			break;
-		case OP_JMPEQ:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			key = popS(); //variable reuse
-			t = equal(v, key);
-			clear_ref(v);
-			clear_ref(key);
-			if (t)
-			{
-				sc->pc += argument - 1;
-			}
-			break;
-		case OP_JMPNE:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			key = popS(); //variable reuse
-			t = equal(v, key);
-			clear_ref(v);
-			clear_ref(key);
-			if (!t)
-			{
-				sc->pc += argument - 1;
-			}
-			break;
-		case OP_LABDA:
-			pushS(new_func(scope, sc->pc));
-			sc->pc += argument - 1;
-			break;
-		case OP_ENTER_SCOPE:
-			push(scope_arr, add_rooted(new_scope(scope)));
-			break;
-		case OP_LEAVE_SCOPE:
-		case OP_LEAVE_ERRHAND:
-			pc = sc->pc;
-			clear_base_ref(pop(scope_arr));
-			sc = toScope(get_head(scope_arr));
-			sc->pc = pc;
-			break;
-		case OP_NEW_LIST:
-			pushS(new_list());
-			break;
-		case OP_POP_FROM:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			container = popS();
-			if (getType(container) != T_LIST)
-			{
-				clear_ref(container);
-				return TypeError;
-			}
-			if (stack_size(toStack(container)) < 1)
-			{
-				clear_ref(container);
-				return ValueError;
-			}
-			v = pop(toStack(container));
-			pushS(v);
+		}
+		while (!toScope(v)->is_func_scope && toScope(v)->file == file);
+		push(scope_arr, add_rooted(v));
+		sc = toScope(v);
+		sc->pc = toFunc(sc->func)->start;
+		LEAVE();
+	CHECKED_TARGET(OP_JMPEQ, 2)
+		v = popS();
+		key = popS(); //variable reuse
+		t = equal(v, key);
+		clear_ref(v);
+		clear_ref(key);
+		if (t)
+		{
+			pc += ARG - 1;
+		}
+		NEXT();
+	CHECKED_TARGET(OP_JMPNE, 2)
+		v = popS();
+		key = popS(); //variable reuse
+		t = equal(v, key);
+		clear_ref(v);
+		clear_ref(key);
+		if (!t)
+		{
+			pc += ARG - 1;
+		}
+		NEXT();
+	TARGET(OP_LABDA)
+		pushS(new_func(scope, pc));
+		pc += ARG - 1;
+		NEXT();
+	TARGET(OP_FLAT_LABDA)
+		// the new function only gets the names that follow its body
+		v = new_closure_scope(scope, pc + ARG);
+		pushS(new_func(v, pc));
+		clear_ref(v);
+		pc += ARG - 1;
+		while (pc[1].opcode == OP_CAPTURE)
+		{
+			pc++;
+		}
+		NEXT();
+	TARGET(OP_CAPTURE)
+		NEXT();
+	TARGET(OP_ENTER_SCOPE)
+		SAVE_PC();
+		push(scope_arr, add_rooted(new_scope(scope)));
+		LEAVE();
+	TARGET(OP_LEAVE_SCOPE)
+		clear_base_ref(pop(scope_arr));
+		sc = toScope(get_head(scope_arr));
+		sc->pc = pc;
+		LEAVE();
+	TARGET(OP_NEW_LIST)
+		pushS(new_list());
+		NEXT();
+	CHECKED_TARGET(OP_POP_FROM, 1)
+		container = popS();
+		if (getType(container) != T_LIST)
+		{
 			clear_ref(container);
-			break;
-		case OP_PUSH_TO:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			container = popS();
-			if (getType(container) != T_LIST)
-			{
-				clear_ref(container);
-				return TypeError;
-			}
-			push(toStack(container), popS());
+			RAISE(TypeError);
+		}
+		if (stack_size(toStack(container)) < 1)
+		{
 			clear_ref(container);
-			break;
-		case OP_PUSH_THROUGH:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			container = popS();
-			if (getType(container) != T_LIST)
+			RAISE(ValueError);
+		}
+		v = pop(toStack(container));
+		shrink_stack(toStack(container), MIN_STACK);
+		pushS(v);
+		clear_ref(container);
+		NEXT();
+	CHECKED_TARGET(OP_PUSH_TO, 2)
+		container = popS();
+		if (getType(container) != T_LIST)
+		{
+			clear_ref(container);
+			RAISE(TypeError);
+		}
+		push(toStack(container), popS());
+		clear_ref(container);
+		NEXT();
+	CHECKED_TARGET(OP_PUSH_THROUGH, 2)
+		container = popS();
+		if (getType(container) != T_LIST)
+		{
+			clear_ref(container);
+			RAISE(TypeError);
+		}
+		push(toStack(container), popS());
+		pushS(container);
+		NEXT();
+	CHECKED_TARGET(OP_DROP, 1)
+		clear_ref(popS());
+		NEXT();
+	CHECKED_TARGET(OP_DUP, 1)
+		pushS(add_ref(get_head(S)));
+		NEXT();
+	CHECKED_TARGET(OP_SWAP, 2)
+		v = S->nodes[S->used - 1];
+		S->nodes[S->used - 1] = S->nodes[S->used - 2];
+		S->nodes[S->used - 2] = v;
+		NEXT();
+	CHECKED_TARGET(OP_ROT, 3)
+		v = S->nodes[S->used-3];
+		S->nodes[S->used-3] = S->nodes[S->used-2];
+		S->nodes[S->used-2] = S->nodes[S->used-1];
+		S->nodes[S->used-1] = v;
+		NEXT();
+	CHECKED_TARGET(OP_OVER, 2)
+		pushS(add_ref(S->nodes[S->used - 2]));
+		NEXT();
+	TARGET(OP_LINE_NUMBER)
+		sc->linenr = ARG;
+		NEXT();
+	TARGET(OP_SOURCE_FILE)
+		toFile(sc->file)->source = LITERAL;
+		//don't bother with refcounting: literals exist
+		//exactly as long as the file they belong to.
+		NEXT();
+	TARGET(OP_ENTER_ERRHAND)
+		// the handler is found through the handler table of the file
+		pc += ARG - 1;
+		NEXT();
+	TARGET(OP_LEAVE_ERRHAND)
+		NEXT();
+	CHECKED_TARGET(OP_RAISE, 1)
+		v = popS();
+		if (getType(v) != T_IDENT)
+		{
+			RAISE(TypeError);
+		}
+		RAISE(ident_to_error(v));
+	CHECKED_TARGET(OP_RERAISE, 1)
+		v = popS();
+		if (getType(v) != T_IDENT)
+		{
+			RAISE(TypeError);
+		}
+		reraise = true;
+		RAISE(ident_to_error(v));
+	TARGET(OP_NEW_DICT)
+		pushS(new_dict());
+		NEXT();
+	CHECKED_TARGET(OP_HAS_DICT, 2)
+		container = popS();
+		key = popS();
+		if (getType(container) != T_DICT)
+		{
+			RAISE(TypeError);
+		}
+		v = real_get_hashmap(toHashMap(container), key);
+		pushS(add_ref(v != NULL ? v_true : v_false));
+		clear_ref(container);
+		clear_ref(key);
+		NEXT();
+	CHECKED_TARGET(OP_GET_DICT, 2)
+		container = popS();
+		key = popS();
+		if (getType(container) == T_DICT)
+		{
+			v = get_hashmap(toHashMap(container), key);
+		}
+		else if (getType(container) == T_LIST)
+		{
+			if (getType(key) != T_NUM)
 			{
 				clear_ref(container);
-				return TypeError;
-			}
-			push(toStack(container), popS());
-			pushS(container);
-			break;
-		case OP_DROP:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			clear_ref(popS());
-			break;
-		case OP_DUP:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			pushS(add_ref(get_head(S)));
-			break;
-		case OP_SWAP:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			V v1 = popS();
-			V v2 = popS();
-			pushS(v1);
-			pushS(v2);
-			break;
-		case OP_ROT:
-			if (stack_size(S) < 3)
-			{
-				return StackEmpty;
-			}
-			v = S->nodes[S->used-3];
-			S->nodes[S->used-3] = S->nodes[S->used-2];
-			S->nodes[S->used-2] = S->nodes[S->used-1];
-			S->nodes[S->used-1] = v;
-		break;
-		case OP_OVER:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			pushS(add_ref(S->nodes[S->used - 2]));
-			break;
-		case OP_LINE_NUMBER:
-			sc->linenr = argument;
-			break;
-		case OP_SOURCE_FILE:
-			toFile(sc->file)->source = get_literal(h, argument);
-			//don't bother with refcounting: literals exist
-			//exactly as long as the file they belong to.
-			break;
-		case OP_ENTER_ERRHAND:
-			v = new_scope(scope);
-			push(scope_arr, add_rooted(v));
-			sc = toScope(v);
-			sc->is_error_handler = true;
-			sc->pc += argument - 1;
-			break;
-		case OP_RAISE:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			if (getType(v) != T_IDENT)
-			{
-				return TypeError;
-			}
-			return ident_to_error(v);
-		case OP_RERAISE:
-			if (stack_size(S) < 1)
-			{
-				return StackEmpty;
-			}
-			v = popS();
-			if (getType(v) != T_IDENT)
-			{
-				return TypeError;
+				clear_ref(key);
+				RAISE(TypeError);
 			}
-			extern bool reraise;
-			reraise = true;
-			return ident_to_error(v);
-		case OP_NEW_DICT:
-			pushS(new_dict());
-			break;
-		case OP_HAS_DICT:
-			if (stack_size(S) < 2)
+			int index = (int)toNumber(key);
+			Stack *s = toStack(container);
+			if (index < 0)
+				index = s->used + index;
+			if (index < 0 || index >= s->used)
 			{
-				return StackEmpty;
+				v = NULL;
 			}
-			container = popS();
-			key = popS();
-			if (getType(container) != T_DICT)
+			else
 			{
-				return TypeError;
+				v = s->nodes[index];
 			}
-			v = real_get_hashmap(toHashMap(container), key);
-			pushS(add_ref(v != NULL ? v_true : v_false));
+		}
+		else
+		{
 			clear_ref(container);
 			clear_ref(key);
-			break;
-		case OP_GET_DICT:
-			if (stack_size(S) < 2)
-			{
-				return StackEmpty;
-			}
-			container = popS();
-			key = popS();
-			if (getType(container) == T_DICT)
-			{
-				v = get_hashmap(toHashMap(container), key);
-			}
-			else if (getType(container) == T_LIST)
-			{
-				if (getType(key) != T_NUM)
-				{
-					clear_ref(container);
-					clear_ref(key);
-					return TypeError;
-				}
-				int index = (int)toNumber(key);
-				Stack *s = toStack(container);
-				if (index < 0)
-					index = s->used + index;
-				if (index < 0 || index >= s->used)
-				{
-					v = NULL;
-				}
-				else
-				{
-					v = s->nodes[index];
-				}
-			}
-			else
+			RAISE(TypeError);
+		}
+		if (v == NULL)
+		{
+			clear_ref(container);
+			clear_ref(key);
+			RAISE(ValueError);
+		}
+		pushS(add_ref(v));
+		clear_ref(container);
+		clear_ref(key);
+		NEXT();
+	CHECKED_TARGET(OP_SET_DICT, 3)
+		container = popS();
+		key = popS();
+		v = popS();
+		if (getType(container) == T_DICT)
+		{
+			set_hashmap(toHashMap(container), key, v);
+		}
+		else if (getType(container) == T_LIST)
+		{
+			if (getType(key) != T_NUM)
 			{
 				clear_ref(container);
 				clear_ref(key);
-				return TypeError;
+				clear_ref(v);
+				RAISE(TypeError);
 			}
-			if (v == NULL)
+			int index = (int)toNumber(key);
+			Stack *s = toStack(container);
+			if (index < 0)
+				index = s->used + index;
+			if (index < 0 || index >= s->used)
 			{
-				clear_ref(container);
 				clear_ref(key);
-				return ValueError;
-			}
-			pushS(add_ref(v));
-			clear_ref(container);
-			clear_ref(key);
-			break;
-		case OP_SET_DICT:
-			if (stack_size(S) < 3)
-			{
-				return StackEmpty;
-			}
-			container = popS();
-			key = popS();
-			v = popS();
-			if (getType(container) == T_DICT)
-			{
-				set_hashmap(toHashMap(container), key, v);
-			}
-			else if (getType(container) == T_LIST)
-			{
-				if (getType(key) != T_NUM)
-				{
-					clear_ref(container);
-					clear_ref(key);
-					clear_ref(v);
-					return TypeError;
-				}
-				int index = (int)toNumber(key);
-				Stack *s = toStack(container);
-				if (index < 0)
-					index = s->used + index;
-				if (index < 0 || index >= s->used)
-				{
-					clear_ref(key);
-					clear_ref(v);
-					clear_ref(container);
-					return ValueError;
-				}
-				else
-				{
-					s->nodes[index] = add_ref(v);
-				}
+				clear_ref(v);
+				clear_ref(container);
+				RAISE(ValueError);
 			}
 			else
 			{
-				clear_ref(key);
-				clear_ref(v);
-				clear_ref(container);
-				return TypeError;
+				s->nodes[index] = add_ref(v);
 			}
+		}
+		else
+		{
 			clear_ref(key);
 			clear_ref(v);
 			clear_ref(container);
-			break;
-		case OP_CALL:
-			v = popS();
-			if (getType(v) == T_IDENT)
+			RAISE(TypeError);
+		}
+		clear_ref(key);
+		clear_ref(v);
+		clear_ref(container);
+		NEXT();
+	CHECKED_TARGET(OP_CALL, 1)
+		lastCall = NULL;
+		v = popS();
+		if (getType(v) == T_IDENT)
+		{
+			key = v;
+			LOOKUP(key);
+			if (v == NULL)
 			{
-				key = v;
-				v = get_hashmap(&sc->hm, key);
-				while (v == NULL)
-				{
-					if (sc->parent == NULL)
-					{
-						return NameError;
-					}
-					sc = toScope(sc->parent);
-					v = get_hashmap(&sc->hm, key);
-				}
+				RAISE(NameError);
 			}
-			if (getType(v) == T_FUNC)
+		}
+		if (getType(v) == T_FUNC)
+		{
+			SAVE_PC();
+			push(scope_arr, add_rooted(new_function_scope(v)));
+			clear_ref(v);
+			LEAVE();
+		}
+		else if (getType(v) == T_CFUNC)
+		{
+			SAVE_PC();
+			if (vm_profile)
 			{
-				push(scope_arr, add_rooted(new_function_scope(v)));
-				clear_ref(v);
+				profile_cfunc(toCFunc(v));
 			}
-			else if (getType(v) == T_CFUNC)
+			e = toCFunc(v)(S, scope_arr);
+			clear_ref(v);
+			if (e != Nothing)
 			{
-				Error r = toCFunc(v)(S, scope_arr);
-				clear_ref(v);
-				return r;
+				return e;
 			}
-			else
+			if (get_head(scope_arr) != scope)
 			{
-				pushS(v);
+				LEAVE();
 			}
-			break;
+			pc = sc->pc;
+		}
+		else
+		{
+			pushS(v);
+		}
+		NEXT();
+	TARGET(OP_ADD)
+		BINARY_OP(add, long int r = a + b; INT_RESULT(r))
+	TARGET(OP_SUB)
+		BINARY_OP(sub, long int r = a - b; INT_RESULT(r))
+	TARGET(OP_MUL)
+		BINARY_OP(mul, long int r; if (!__builtin_mul_overflow(a, b, &r)) INT_RESULT(r))
+	TARGET(OP_LT)
+		BINARY_OP(lt, BOOL_RESULT(a < b))
+	TARGET(OP_GT)
+		BINARY_OP(gt, BOOL_RESULT(a > b))
+	TARGET(OP_LE)
+		BINARY_OP(le, BOOL_RESULT(a <= b))
+	TARGET(OP_GE)
+		BINARY_OP(ge, BOOL_RESULT(a >= b))
+	TARGET(OP_EQ)
+		BINARY_OP(eq, BOOL_RESULT(a == b))
+	CHECKED_TARGET(OP_DUP_JMPZ, 1)
+		pc += truthy(get_head(S)) ? 1 : pc[1].arg;
+		NEXT();
+	TARGET(OP_LEAVE_SCOPE_JMP)
+		clear_base_ref(pop(scope_arr));
+		sc = toScope(get_head(scope_arr));
+		sc->pc = pc + pc[1].arg;
+		LEAVE();
+	TARGET(OP_LT_JMPZ)
+		BINARY_OP(lt, JUMP_UNLESS(a < b))
+	TARGET(OP_GT_JMPZ)
+		BINARY_OP(gt, JUMP_UNLESS(a > b))
+	TARGET(OP_LE_JMPZ)
+		BINARY_OP(le, JUMP_UNLESS(a <= b))
+	TARGET(OP_GE_JMPZ)
+		BINARY_OP(ge, JUMP_UNLESS(a >= b))
+	TARGET(OP_EQ_JMPZ)
+		BINARY_OP(eq, JUMP_UNLESS(a == b))
+#ifdef THREADED
+	L_OP_UNKNOWN:
+#else
+	default:
+#endif
+		NEXT();
+#ifndef THREADED
 	}
-	return Nothing;
+#endif
+}
+
+// run the instruction after sc->pc in the head of scope_arr, and no more
+Error step_instruction(Stack* S, Stack* scope_arr)
+{
+	single_step = true;
+	return do_instructions(S, scope_arr);
 }
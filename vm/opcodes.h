@@ -14,15 +14,22 @@
 #define OP_SET_GLOBAL     0x05
 #define OP_GET            0x06
 #define OP_GET_GLOBAL     0x07
+#define OP_PUSH_SLOT      0x08
+#define OP_SET_SLOT       0x09
+#define OP_SET_LOCAL_SLOT 0x0A
+#define OP_GET_SLOT       0x0B
 #define OP_JMP            0x10
 #define OP_JMPZ           0x11
 #define OP_RETURN         0x12
 #define OP_RECURSE        0x13
 #define OP_JMPEQ          0x14
 #define OP_JMPNE          0x15
+#define OP_TAILCALL       0x16
 #define OP_LABDA          0x20
 #define OP_ENTER_SCOPE    0x21
 #define OP_LEAVE_SCOPE    0x22
+#define OP_FLAT_LABDA     0x23
+#define OP_CAPTURE        0x24
 #define OP_NEW_LIST       0x30
 #define OP_POP_FROM       0x31
 #define OP_PUSH_TO        0x32
@@ -43,7 +50,32 @@
 #define OP_GET_DICT       0x72
 #define OP_SET_DICT       0x73
 #define OP_CALL           0x80
+#define OP_ADD            0x90
+#define OP_SUB            0x91
+#define OP_MUL            0x92
+#define OP_LT             0x93
+#define OP_GT             0x94
+#define OP_LE             0x95
+#define OP_GE             0x96
+#define OP_EQ             0x97
+#define OP_DUP_JMPZ       0xA0
+#define OP_LEAVE_SCOPE_JMP 0xA1
+#define OP_LT_JMPZ        0xA2
+#define OP_GT_JMPZ        0xA3
+#define OP_LE_JMPZ        0xA4
+#define OP_GE_JMPZ        0xA5
+#define OP_EQ_JMPZ        0xA6
 
-Error inline do_instruction(Header*, Stack*, Stack*);
+// not in bytecode: set by the verifier where the stack is known to be deep enough
+#define UNCHECKED(op)     ((op) | 0x100)
+#define BASE_OPCODE(op)   ((op) & 0xFF)
+
+// not in bytecode: PUSH_WORD rewrites itself into these
+#define OP_PUSH_WORD_CFUNC 0xB0
+#define OP_PUSH_WORD_FUNC  0xB1
+#define OP_PUSH_WORD_VALUE 0xB2
+
+Error do_instructions(Stack*, Stack*);
+Error step_instruction(Stack*, Stack*);
 
 #endif
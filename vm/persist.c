@@ -9,6 +9,7 @@
 #include "stack.h"
 #include "literals.h"
 #include "strings.h"
+#include "bigint.h"
 
 bool persist_collect_(V original, HashMap *hm)
 {
@@ -31,6 +32,8 @@ bool persist_collect_(V original, HashMap *hm)
 		case T_IDENT:
 		case T_NUM:
 		case T_FRAC:
+		case T_BIGINT:
+		case T_BIGFRAC:
 			break;
 		case T_LIST:
 			for (i = 0; i < toStack(original)->used; i++)
@@ -47,14 +50,13 @@ bool persist_collect_(V original, HashMap *hm)
 			{
 				for (i = 0; i < hmv->size; i++)
 				{
-					b = hmv->map[i];
-					while(b != NULL)
+					b = &hmv->map[i];
+					if (b->key != NULL)
 					{
 						if (!persist_collect_(b->key, hm) ||!persist_collect_(b->value, hm))
 						{
 							return false;
 						}
-						b = b->next;
 					}
 				}
 			}
@@ -88,15 +90,14 @@ int persist_order_objects(HashMap *hm)
 		found = false;
 		for (i = 0; i < hm->size; i++)
 		{
-			b = hm->map[i];
-			while (b != NULL)
+			b = &hm->map[i];
+			if (b->key != NULL)
 			{
 				if (toInt(b->value) == level)
 				{
 					b->value = intToV(index++);
 					found = true;
 				}
-				b = b->next;
 			}
 		}
 	}
@@ -116,6 +117,40 @@ bool canBeSmallInt(V obj)
 	return isInt(obj) && (toInt(obj) > -(1 << 23)) && (toInt(obj) < (1 << 23));
 }
 
+// a tagged int or BigInt, the way read_literals reads a BigInt
+static void write_integer(FILE *file, V v)
+{
+	uint32_t buf[2];
+	uint32_t *limbs = buf;
+	uint32_t size;
+	uint32_t l32;
+	int8_t sign;
+	uint64_t m;
+	uint32_t i;
+	if (isInt(v))
+	{
+		sign = toInt(v) < 0 ? -1 : 1;
+		m = toInt(v) < 0 ? -(uint64_t)toInt(v) : (uint64_t)toInt(v);
+		buf[0] = m;
+		buf[1] = m >> 32;
+		size = buf[1] ? 2 : buf[0] ? 1 : 0;
+	}
+	else
+	{
+		sign = toBigInt(v)->sign;
+		size = toBigInt(v)->size;
+		limbs = toBigInt(v)->limbs;
+	}
+	l32 = htonl(size);
+	fwrite(&l32, 4, 1, file);
+	fwrite(&sign, 1, 1, file);
+	for (i = 0; i < size; i++)
+	{
+		l32 = htonl(limbs[i]);
+		fwrite(&l32, 4, 1, file);
+	}
+}
+
 void write_object(FILE *file, V obj, HashMap *hm)
 {
 	int t = getType(obj);
@@ -215,13 +250,20 @@ void write_object(FILE *file, V obj, HashMap *hm)
 			else
 			{
 				n64 = toNumerator(obj);
-				n64 = htonl(n64);
+				n64 = htonll(n64);
 				fwrite(&n64, 8, 1, file);
 				l64 = toDenominator(obj);
-				l64 = htonl(l64);
+				l64 = htonll(l64);
 				fwrite(&l64, 8, 1, file);
 			}
 			break;
+		case T_BIGINT:
+			write_integer(file, obj);
+			break;
+		case T_BIGFRAC:
+			write_integer(file, toBigFrac(obj)->numerator);
+			write_integer(file, toBigFrac(obj)->denominator);
+			break;
 		case T_PAIR:
 			write_ref(file, toFirst(obj), hm);
 			write_ref(file, toSecond(obj), hm);
@@ -245,12 +287,11 @@ void write_object(FILE *file, V obj, HashMap *hm)
 			{
 				for (i = 0; i < hmv->size; i++)
 				{
-					b = hmv->map[i];
-					while(b != NULL)
+					b = &hmv->map[i];
+					if (b->key != NULL)
 					{
 						write_ref(file, b->key, hm);
 						write_ref(file, b->value, hm);
-						b = b->next;
 					}
 				}
 			}
@@ -265,7 +306,7 @@ bool persist(char *fname, V obj)
 	int maxm;
 	FILE *file;
 	uint32_t obj_encoded;
-	Bucket *b, *bb;
+	Bucket *b;
 
 	hm = persist_collect(obj);
 	if (hm)
@@ -282,11 +323,10 @@ bool persist(char *fname, V obj)
 
 		for (i = 0; i < hm->size; i++)
 		{
-			b = hm->map[i];
-			while (b != NULL)
+			b = &hm->map[i];
+			if (b->key != NULL)
 			{
 				reverse_lookup[toInt(b->value)] = b->key;
-				b = b->next;
 			}
 		}
 
@@ -297,20 +337,7 @@ bool persist(char *fname, V obj)
 
 		fclose(file);
 
-		if (hm->map != NULL)
-		{
-			for (i = 0; i < hm->size; i++)
-			{
-				b = hm->map[i];
-				while(b != NULL)
-				{
-					bb = b;
-					b = b->next;
-					free(bb);
-				}
-			}
-			free(hm->map);
-		}
+		free(hm->map);
 		free(hm);
 
 		return true;
@@ -372,11 +399,10 @@ bool persist_all_file(FILE *file, Stack *objects)
 	{
 		for (i = 0; i < hm->size; i++)
 		{
-			b = hm->map[i];
-			while (b != NULL)
+			b = &hm->map[i];
+			if (b->key != NULL)
 			{
 				reverse_lookup[toInt(b->value)] = b->key;
-				b = b->next;
 			}
 		}
 	}
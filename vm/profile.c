@@ -0,0 +1,566 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+#include "func.h"
+#include "file.h"
+#include "opcodes.h"
+#include "strings.h"
+
+/* The profiler.
+ * With --profile, do_instructions calls profile_instruction before
+ * every instruction, and the run loop calls profile_enter every time
+ * the scope stack may have changed. Instructions are counted per
+ * source line and per node of the call tree; wall time is charged to
+ * the node that was running between two calls of profile_enter.
+ * Functions are told apart by their code, so all closures made from
+ * the same labda count as one, named after the word they were first
+ * called by. Files are the roots of the call tree.
+ */
+
+extern V lastCall;
+
+bool vm_profile = false;
+char *vm_profile_name = "vu-profile";
+bool vm_opcode_stats = false;
+
+// a function, a source line or a CFunc
+typedef struct Entry
+{
+	const void *key;
+	uint32_t linenr;
+	V name;
+	V file;
+	unsigned long instructions;
+	unsigned long calls;
+	double time;
+} Entry;
+
+typedef struct Table
+{
+	int size;
+	int used;
+	Entry **entries;
+} Table;
+
+typedef struct Node
+{
+	Entry *func;
+	struct Node *parent;
+	struct Node *child;
+	struct Node *next;
+	unsigned long instructions;
+	double time;
+} Node;
+
+// mirrors the scope stack
+typedef struct ProfFrame
+{
+	V scope;
+	Entry *func;
+	Node *node;
+} ProfFrame;
+
+static Table funcs;
+static Table lines;
+static Table cfuncs;
+
+static Node root;
+static Node *current = &root;
+static ProfFrame *frames = NULL;
+static int depth = 0;
+static int max_depth = 0;
+static double last_time = 0;
+
+static Entry *last_line = NULL;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Entry** find_slot(Table *t, const void *key, uint32_t linenr)
+{
+	uint32_t i = (((uintptr_t)key >> 3) ^ (linenr * 0x9E3779B1u)) & (t->size - 1);
+	while (t->entries[i] != NULL && (t->entries[i]->key != key || t->entries[i]->linenr != linenr))
+	{
+		i = (i + 1) & (t->size - 1);
+	}
+	return &t->entries[i];
+}
+
+// find the entry for key and linenr, adding it if it is new
+static Entry* get_entry(Table *t, const void *key, uint32_t linenr, bool *is_new)
+{
+	int i;
+	Entry **slot;
+	if (t->used * 2 >= t->size)
+	{
+		Table old = *t;
+		t->size = old.size ? old.size * 2 : 64;
+		t->entries = calloc(t->size, sizeof(Entry*));
+		for (i = 0; i < old.size; i++)
+		{
+			if (old.entries[i] != NULL)
+			{
+				*find_slot(t, old.entries[i]->key, old.entries[i]->linenr) = old.entries[i];
+			}
+		}
+		free(old.entries);
+	}
+	slot = find_slot(t, key, linenr);
+	*is_new = *slot == NULL;
+	if (*is_new)
+	{
+		*slot = calloc(1, sizeof(Entry));
+		(*slot)->key = key;
+		(*slot)->linenr = linenr;
+		t->used++;
+	}
+	return *slot;
+}
+
+// the line a function is defined on, from the first line number in its body
+static uint32_t definition_line(Instruction *start)
+{
+	int i;
+	for (i = 1; i < 8; i++)
+	{
+		if (start[i].opcode == OP_LINE_NUMBER)
+		{
+			return start[i].arg;
+		}
+	}
+	return 0;
+}
+
+static Entry* func_entry(Scope *sc)
+{
+	bool is_new;
+	Entry *e;
+	if (sc->func == NULL)
+	{
+		e = get_entry(&funcs, toFile(sc->file)->code, 0, &is_new);
+	}
+	else
+	{
+		Instruction *start = toFunc(sc->func)->start;
+		e = get_entry(&funcs, start, definition_line(start), &is_new);
+		e->name = is_new ? lastCall : e->name;
+	}
+	if (is_new)
+	{
+		e->file = add_ref(sc->file);
+	}
+	return e;
+}
+
+static Node* child_node(Node *parent, Entry *func)
+{
+	Node *n;
+	for (n = parent->child; n != NULL; n = n->next)
+	{
+		if (n->func == func)
+		{
+			return n;
+		}
+	}
+	n = calloc(1, sizeof(Node));
+	n->func = func;
+	n->parent = parent;
+	n->next = parent->child;
+	parent->child = n;
+	return n;
+}
+
+void profile_enter(Stack *scope_arr)
+{
+	int i;
+	double t = now();
+	V scope;
+	Scope *sc;
+	Node *parent;
+	if (last_time != 0)
+	{
+		current->time += t - last_time;
+		if (current->func != NULL)
+		{
+			current->func->time += t - last_time;
+		}
+	}
+	last_time = t;
+
+	// find the part of the scope stack that did not change
+	for (i = 0; i < depth && i < scope_arr->used; i++)
+	{
+		sc = toScope(scope_arr->nodes[i]);
+		if (frames[i].scope != scope_arr->nodes[i] ||
+			(sc->func != NULL && frames[i].func->key != toFunc(sc->func)->start))
+		{
+			break;
+		}
+	}
+	depth = i;
+	if (scope_arr->used > max_depth)
+	{
+		max_depth = scope_arr->used * 2;
+		frames = realloc(frames, max_depth * sizeof(ProfFrame));
+	}
+	for (; depth < scope_arr->used; depth++)
+	{
+		scope = scope_arr->nodes[depth];
+		sc = toScope(scope);
+		frames[depth].scope = scope;
+		if (sc->is_func_scope)
+		{
+			frames[depth].func = func_entry(sc);
+			frames[depth].func->calls++;
+			// files start a new stack
+			parent = sc->func != NULL && depth > 0 ? frames[depth - 1].node : &root;
+			frames[depth].node = child_node(parent, frames[depth].func);
+		}
+		else
+		{
+			frames[depth].func = depth > 0 ? frames[depth - 1].func : NULL;
+			frames[depth].node = depth > 0 ? frames[depth - 1].node : &root;
+		}
+	}
+	current = depth > 0 ? frames[depth - 1].node : &root;
+}
+
+void profile_instruction(Scope *sc)
+{
+	bool is_new;
+	V file = sc->file;
+	current->instructions++;
+	if (current->func != NULL)
+	{
+		current->func->instructions++;
+	}
+	if (last_line == NULL || last_line->key != file || last_line->linenr != sc->linenr)
+	{
+		last_line = get_entry(&lines, file, sc->linenr, &is_new);
+		if (is_new)
+		{
+			last_line->file = add_ref(file);
+		}
+	}
+	last_line->instructions++;
+}
+
+void profile_cfunc(CFuncP f)
+{
+	bool is_new;
+	get_entry(&cfuncs, f, 0, &is_new)->calls++;
+}
+
+// the source file name if the file has one, otherwise its path
+static void print_file(FILE *f, V file)
+{
+	V name = toFile(file)->source != NULL ? toFile(file)->source : toFile(file)->name;
+	fprintf(f, "%.*s", (int)toNewString(name)->size, toNewString(name)->text);
+}
+
+static void print_func(FILE *f, Entry *e)
+{
+	if (e->key == toFile(e->file)->code)
+	{
+		print_file(f, e->file);
+		return;
+	}
+	if (e->name == NULL)
+	{
+		fputs("labda", f);
+	}
+	else
+	{
+		fprintf(f, "%.*s", (int)toIdent(e->name)->length, toIdent(e->name)->data);
+	}
+	fputc('@', f);
+	print_file(f, e->file);
+	fprintf(f, ":%u", e->linenr);
+}
+
+static int by_instructions(const void *a, const void *b)
+{
+	const Entry *x = *(Entry**)a, *y = *(Entry**)b;
+	return x->instructions < y->instructions ? 1 : x->instructions > y->instructions ? -1 : 0;
+}
+
+static int by_calls(const void *a, const void *b)
+{
+	const Entry *x = *(Entry**)a, *y = *(Entry**)b;
+	return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+
+// the entries of t, sorted
+static Entry** sorted(Table *t, int (*cmp)(const void*, const void*))
+{
+	int i, n = 0;
+	Entry **list = malloc((t->used + 1) * sizeof(Entry*));
+	for (i = 0; i < t->size; i++)
+	{
+		if (t->entries[i] != NULL)
+		{
+			list[n++] = t->entries[i];
+		}
+	}
+	qsort(list, n, sizeof(Entry*), cmp);
+	return list;
+}
+
+static void write_flat(FILE *f)
+{
+	int i;
+	unsigned long total = 0;
+	Entry **list;
+
+	list = sorted(&lines, by_instructions);
+	for (i = 0; i < lines.used; i++)
+	{
+		total += list[i]->instructions;
+	}
+	fprintf(f, "%lu instructions\n", total);
+	if (total == 0)
+	{
+		total = 1;
+	}
+
+	fputs("\nfunctions:\n  self%  instructions      calls    seconds  function\n", f);
+	free(list);
+	list = sorted(&funcs, by_instructions);
+	for (i = 0; i < funcs.used; i++)
+	{
+		fprintf(f, "%6.2f %13lu %10lu %10.6f  ", 100.0 * list[i]->instructions / total,
+			list[i]->instructions, list[i]->calls, list[i]->time);
+		print_func(f, list[i]);
+		fputc('\n', f);
+	}
+
+	fputs("\nlines:\n  self%  instructions  line\n", f);
+	free(list);
+	list = sorted(&lines, by_instructions);
+	for (i = 0; i < lines.used; i++)
+	{
+		fprintf(f, "%6.2f %13lu  ", 100.0 * list[i]->instructions / total, list[i]->instructions);
+		print_file(f, list[i]->file);
+		fprintf(f, ":%u\n", list[i]->linenr);
+	}
+
+	fputs("\ncfuncs:\n     calls  cfunc\n", f);
+	free(list);
+	list = sorted(&cfuncs, by_calls);
+	for (i = 0; i < cfuncs.used; i++)
+	{
+		const char *name = cfunc_name((CFuncP)list[i]->key);
+		fprintf(f, "%10lu  %s\n", list[i]->calls, name ? name : "?");
+	}
+	free(list);
+}
+
+static void write_path(FILE *f, Node *n)
+{
+	if (n->parent != &root)
+	{
+		write_path(f, n->parent);
+		fputc(';', f);
+	}
+	print_func(f, n->func);
+}
+
+// one line per call stack, weighted by instructions
+static void write_folded(FILE *f, Node *n)
+{
+	Node *c;
+	if (n != &root && n->instructions > 0)
+	{
+		write_path(f, n);
+		fprintf(f, " %lu\n", n->instructions);
+	}
+	for (c = n->child; c != NULL; c = c->next)
+	{
+		write_folded(f, c);
+	}
+}
+
+void profile_write(void)
+{
+	FILE *f;
+	size_t len = strlen(vm_profile_name);
+	char *fname = malloc(len + sizeof(".folded"));
+	Stack empty = {.size = 0, .used = 0, .nodes = NULL};
+	profile_enter(&empty); // charge the time since the last call
+
+	sprintf(fname, "%s.txt", vm_profile_name);
+	if ((f = fopen(fname, "w")) != NULL)
+	{
+		write_flat(f);
+		fclose(f);
+	}
+	else
+	{
+		perror(fname);
+	}
+
+	sprintf(fname, "%s.folded", vm_profile_name);
+	if ((f = fopen(fname, "w")) != NULL)
+	{
+		write_folded(f, &root);
+		fclose(f);
+	}
+	else
+	{
+		perror(fname);
+	}
+	free(fname);
+}
+
+/* Opcode statistics.
+ * With --opcode-stats, every executed instruction is counted, and so
+ * is every pair of instructions that ran one after the other without
+ * a jump in between: those are the candidates for superinstructions.
+ */
+
+static unsigned long opcode_counts[256];
+static unsigned long pair_counts[256][256];
+static Instruction *last_pc = NULL;
+
+static const char* opcode_names[256] = {
+	[OP_PUSH_LITERAL] = "PUSH_LITERAL",
+	[OP_PUSH_INTEGER] = "PUSH_INTEGER",
+	[OP_PUSH_WORD] = "PUSH_WORD",
+	[OP_SET] = "SET",
+	[OP_SET_LOCAL] = "SET_LOCAL",
+	[OP_SET_GLOBAL] = "SET_GLOBAL",
+	[OP_GET] = "GET",
+	[OP_GET_GLOBAL] = "GET_GLOBAL",
+	[OP_PUSH_SLOT] = "PUSH_SLOT",
+	[OP_SET_SLOT] = "SET_SLOT",
+	[OP_SET_LOCAL_SLOT] = "SET_LOCAL_SLOT",
+	[OP_GET_SLOT] = "GET_SLOT",
+	[OP_JMP] = "JMP",
+	[OP_JMPZ] = "JMPZ",
+	[OP_RETURN] = "RETURN",
+	[OP_RECURSE] = "RECURSE",
+	[OP_JMPEQ] = "JMPEQ",
+	[OP_JMPNE] = "JMPNE",
+	[OP_TAILCALL] = "TAILCALL",
+	[OP_LABDA] = "LABDA",
+	[OP_FLAT_LABDA] = "FLAT_LABDA",
+	[OP_CAPTURE] = "CAPTURE",
+	[OP_ENTER_SCOPE] = "ENTER_SCOPE",
+	[OP_LEAVE_SCOPE] = "LEAVE_SCOPE",
+	[OP_NEW_LIST] = "NEW_LIST",
+	[OP_POP_FROM] = "POP_FROM",
+	[OP_PUSH_TO] = "PUSH_TO",
+	[OP_PUSH_THROUGH] = "PUSH_THROUGH",
+	[OP_DROP] = "DROP",
+	[OP_DUP] = "DUP",
+	[OP_SWAP] = "SWAP",
+	[OP_ROT] = "ROT",
+	[OP_OVER] = "OVER",
+	[OP_LINE_NUMBER] = "LINE_NUMBER",
+	[OP_SOURCE_FILE] = "SOURCE_FILE",
+	[OP_ENTER_ERRHAND] = "ENTER_ERRHAND",
+	[OP_LEAVE_ERRHAND] = "LEAVE_ERRHAND",
+	[OP_RAISE] = "RAISE",
+	[OP_RERAISE] = "RERAISE",
+	[OP_NEW_DICT] = "NEW_DICT",
+	[OP_HAS_DICT] = "HAS_DICT",
+	[OP_GET_DICT] = "GET_DICT",
+	[OP_SET_DICT] = "SET_DICT",
+	[OP_CALL] = "CALL",
+	[OP_ADD] = "ADD",
+	[OP_SUB] = "SUB",
+	[OP_MUL] = "MUL",
+	[OP_LT] = "LT",
+	[OP_GT] = "GT",
+	[OP_LE] = "LE",
+	[OP_GE] = "GE",
+	[OP_EQ] = "EQ",
+	[OP_DUP_JMPZ] = "DUP_JMPZ",
+	[OP_LEAVE_SCOPE_JMP] = "LEAVE_SCOPE_JMP",
+	[OP_LT_JMPZ] = "LT_JMPZ",
+	[OP_GT_JMPZ] = "GT_JMPZ",
+	[OP_LE_JMPZ] = "LE_JMPZ",
+	[OP_GE_JMPZ] = "GE_JMPZ",
+	[OP_EQ_JMPZ] = "EQ_JMPZ",
+	[OP_PUSH_WORD_CFUNC] = "PUSH_WORD_CFUNC",
+	[OP_PUSH_WORD_FUNC] = "PUSH_WORD_FUNC",
+	[OP_PUSH_WORD_VALUE] = "PUSH_WORD_VALUE",
+};
+
+void count_opcode(Instruction *pc)
+{
+	opcode_counts[BASE_OPCODE(pc->opcode)]++;
+	if (last_pc != NULL && pc == last_pc + 1)
+	{
+		pair_counts[BASE_OPCODE(last_pc->opcode)][BASE_OPCODE(pc->opcode)]++;
+	}
+	last_pc = pc;
+}
+
+static const char* opcode_name(int op)
+{
+	static char unknown[8];
+	if (opcode_names[op] != NULL)
+	{
+		return opcode_names[op];
+	}
+	sprintf(unknown, "0x%02X", op);
+	return unknown;
+}
+
+static int by_count(const void *a, const void *b)
+{
+	unsigned long x = **(unsigned long**)a, y = **(unsigned long**)b;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+#define MAX_PAIRS 40
+
+void print_opcode_stats(FILE *f)
+{
+	int i, n = 0;
+	unsigned long total = 0;
+	unsigned long *counts[256 * 256];
+	for (i = 0; i < 256; i++)
+	{
+		total += opcode_counts[i];
+		if (opcode_counts[i] > 0)
+		{
+			counts[n++] = &opcode_counts[i];
+		}
+	}
+	if (total == 0)
+	{
+		total = 1;
+	}
+	qsort(counts, n, sizeof(unsigned long*), by_count);
+	fputs("opcodes:\n", f);
+	for (i = 0; i < n; i++)
+	{
+		fprintf(f, "%6.2f%% %12lu  %s\n", 100.0 * *counts[i] / total, *counts[i],
+			opcode_name(counts[i] - opcode_counts));
+	}
+	n = 0;
+	for (i = 0; i < 256 * 256; i++)
+	{
+		if (pair_counts[i / 256][i % 256] > 0)
+		{
+			counts[n++] = &pair_counts[i / 256][i % 256];
+		}
+	}
+	qsort(counts, n, sizeof(unsigned long*), by_count);
+	fputs("pairs:\n", f);
+	for (i = 0; i < n && i < MAX_PAIRS; i++)
+	{
+		int pair = counts[i] - &pair_counts[0][0];
+		fprintf(f, "%6.2f%% %12lu  %s", 100.0 * *counts[i] / total, *counts[i], opcode_name(pair / 256));
+		fprintf(f, " %s\n", opcode_name(pair % 256));
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef PROFILE_DEF
+#define PROFILE_DEF
+
+#include "stack.h"
+#include "scope.h"
+#include "lib.h"
+
+extern bool vm_profile;
+extern char *vm_profile_name;
+extern bool vm_opcode_stats;
+
+void profile_enter(Stack*);
+void profile_instruction(Scope*);
+void profile_cfunc(CFuncP);
+void profile_write(void);
+void count_opcode(Instruction*);
+void print_opcode_stats(FILE*);
+
+#endif
@@ -4,11 +4,48 @@
 #include "error.h"
 #include "debug.h"
 #include "persist.h"
+#include "alloc.h"
+#include "profile.h"
 
-bool reraise;
+bool reraise = false;
 bool vm_silent = false;
 bool vm_debug = false;
 bool vm_persist = false;
+bool vm_gc_stats = false;
+
+/* Finds the innermost try around the code each scope is running, from
+ * the top of the scope stack down. Block scopes made inside the body
+ * are left too, so depth is the number of scopes that remain, with
+ * the one that entered the try on top.
+ */
+static Handler *find_try(Stack *scope, int *depth)
+{
+	int i;
+	Scope *sc;
+	Scope *below;
+	Handler *handler;
+	for (i = stack_size(scope) - 1; i >= 0; i--)
+	{
+		sc = toScope(scope->nodes[i]);
+		if (sc->file == NULL || (handler = find_handler(sc->file, sc->pc)) == NULL)
+		{
+			continue;
+		}
+		while (i > 0 && !sc->is_func_scope)
+		{
+			below = toScope(scope->nodes[i - 1]);
+			if (below->file != sc->file || below->pc < handler->start || below->pc >= handler->end)
+			{
+				break;
+			}
+			sc = below;
+			i--;
+		}
+		*depth = i + 1;
+		return handler;
+	}
+	return NULL;
+}
 
 void run(V file_name, Stack *S)
 {
@@ -23,7 +60,8 @@ void run(V file_name, Stack *S)
 	}
 	Stack *scope = new_stack();
 	Stack *save_scopes = new_stack();
-	Scope *sc;
+	Handler *handler;
+	int depth;
 	push(scope, add_rooted(new_file_scope(file)));
 	if (vm_persist)
 	{
@@ -39,39 +77,47 @@ void run(V file_name, Stack *S)
 	push(scope, add_rooted(new_file_scope(load_std(global))));
 	while (e == Nothing)
 	{
-		sc = toScope(get_head(scope));
-		sc->pc++;
-		reraise = false;
-		e = do_instruction(&toFile(sc->file)->header, S, scope);
+		if (vm_profile)
+		{
+			profile_enter(scope);
+		}
+		e = do_instructions(S, scope);
+		if (gc_pending)
+		{
+			collect_slice();
+			shrink_stack(S, STACK_SEGMENT);
+			shrink_stack(scope, MIN_STACK);
+		}
 		if (e != Nothing && e != Exit)
 		{
 			DBG_PRINTF("Error %d %sraised", e, reraise ? "re" : "");
-			if (!reraise)
-			{
-				while (stack_size(save_scopes) > 0)
+			handler = find_try(scope, &depth);
+			if (handler != NULL)
+			{ //Let error be handled by code
+				if (!reraise)
 				{
-					clear_base_ref(pop(save_scopes));
+					while (stack_size(save_scopes) > 0)
+					{
+						clear_base_ref(pop(save_scopes));
+					}
 				}
-
-			}
-			do
-			{
-				push(save_scopes, pop(scope));
-				sc = toScope(get_head(save_scopes));
-			}
-			while (stack_size(scope) > 0 && !sc->is_error_handler);
-			if (stack_size(scope) > 0)
-			{ //Let error be handled by code
+				//keep the scopes it came from, in case it is reraised
+				while (stack_size(scope) > depth)
+				{
+					push(save_scopes, pop(scope));
+				}
+				toScope(get_head(scope))->pc = handler->handler;
 				pushS(add_ref(error_to_ident(e)));
 				e = Nothing;
 			}
-			else
-			{ //Error slips away, uncaught
+			else if (reraise)
+			{ //Error slips away, uncaught, from where it was raised first
 				while (stack_size(save_scopes) > 0)
 				{
 					push(scope, pop(save_scopes));
 				}
 			}
+			reraise = false;
 		}
 	}
 	if (e == Exit)
@@ -99,4 +145,17 @@ void run(V file_name, Stack *S)
 	clear_stack(scope);
 	clear_stack(save_scopes);
 	clear_ref(file);
+	IF_DBG(print_pool_stats(stderr);)
+	if (vm_profile)
+	{
+		profile_write();
+	}
+	if (vm_opcode_stats)
+	{
+		print_opcode_stats(stderr);
+	}
+	if (vm_gc_stats)
+	{
+		print_gc_stats(stderr);
+	}
 }
@@ -1,82 +1,445 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "scope.h"
 #include "func.h"
 #include "file.h"
+#include "alloc.h"
+#include "jit.h"
+#include "opcodes.h"
 
-V create_scope()
+/* Freed scopes go on a free list, linked through their parent, and
+ * keep their bucket array so the next scope can use it without
+ * allocating. Bucket arrays that grew past MAX_RECYCLED_MAP are
+ * freed instead, so one big scope does not pin its memory forever.
+ */
+#define MAX_RECYCLED_MAP 64
+
+static V free_scopes = NULL;
+
+static V create_scope(int initialsize)
 {
-	if (MAXSCOPE < MAXCACHE)
+	V sc = free_scopes;
+	if (sc == NULL)
 	{
-		ValueScope *sc = &SCOPECACHE[MAXSCOPE];
-		sc->v.buffered = false;
-		sc->v.type = T_SCOPE;
-		sc->v.refs = 1;
-		sc->v.color = Black;
-		sc->sc.index = ++MAXSCOPE;
-		return (V)sc;
+		sc = make_new_value(T_SCOPE, false, sizeof(Scope));
+		hashmap_from_scope(sc, initialsize);
+		return sc;
 	}
-	else
+	free_scopes = toScope(sc)->parent;
+	count_new_value(T_SCOPE, sizeof(Scope));
+	sc->buffered = false;
+	sc->refs = 1;
+	sc->baserefs = 0;
+	sc->color = Black;
+	if (toScope(sc)->hm.map == NULL)
 	{
-		V val = make_new_value(T_SCOPE, false, sizeof(Scope));
-		toScope(val)->index = 0;
-		return val;
+		hashmap_from_scope(sc, initialsize);
 	}
+	return sc;
 }
 
+/* The frame stack.
+ * Only the scope stack and its own block scopes refer to the scope of
+ * a function whose Frame does not escape, so it is released when the
+ * function returns, after every scope created since. The same goes
+ * for those block scopes. Such scopes are
+ * allocated contiguously on the frame stack, with their slots right
+ * behind them, and handed back in reverse order. Every block starts
+ * with a pointer to the one below it; a block released while others
+ * are still above it is popped together with the last of them.
+ * When the frame stack is full, scopes come from the heap as usual.
+ */
+#define FRAME_STACK_SIZE (32 << 20)
+
+static char *frame_stack = NULL;
+static char *frame_top = NULL;
+static char *top_block = NULL;
+
+#define BLOCK_VALUE(b) ((V)((b) + sizeof(char*)))
+#define BLOCK_BELOW(b) (*(char**)(b))
+
+bool on_frame_stack(V sc)
+{
+	return (char*)sc >= frame_stack && (char*)sc < frame_stack + FRAME_STACK_SIZE;
+}
+
+static V create_frame_scope(int n_slots)
+{
+	size_t size = sizeof(char*) + sizeof(Value) + sizeof(Scope) + n_slots * sizeof(V);
+	size = (size + 15) & ~(size_t)15;
+	if (frame_stack == NULL)
+	{
+		frame_stack = frame_top = malloc(FRAME_STACK_SIZE);
+	}
+	if (frame_top + size > frame_stack + FRAME_STACK_SIZE)
+	{
+		return NULL;
+	}
+	char *block = frame_top;
+	BLOCK_BELOW(block) = top_block;
+	top_block = block;
+	frame_top += size;
+	V sc = BLOCK_VALUE(block);
+	count_new_value(T_SCOPE, sizeof(Scope));
+	sc->buffered = false;
+	sc->type = T_SCOPE;
+	sc->refs = 1;
+	sc->baserefs = 0;
+	sc->color = Black;
+	hashmap_from_scope(sc, 8);
+	toScope(sc)->slots = (V*)(toScope(sc) + 1);
+	memset(toScope(sc)->slots, 0, n_slots * sizeof(V));
+	return sc;
+}
+
+static void release_frame_scope(V sc)
+{
+	Scope* scope = toScope(sc);
+	free(scope->hm.map);
+	scope->hm.map = NULL;
+	sc->refs = 0;
+	while (top_block != NULL && BLOCK_VALUE(top_block)->refs == 0 && !BLOCK_VALUE(top_block)->buffered)
+	{
+		frame_top = top_block;
+		top_block = BLOCK_BELOW(top_block);
+	}
+}
+
+// called by free_value, after the children of sc have been released
+void recycle_scope(V sc)
+{
+	Scope* scope = toScope(sc);
+	if (on_frame_stack(sc))
+	{
+		release_frame_scope(sc);
+		return;
+	}
+	if (scope->slots != NULL)
+	{
+		pool_free(scope->slots, scope->n_slots * sizeof(V));
+		scope->slots = NULL;
+	}
+	if (scope->hm.map != NULL)
+	{
+		if (scope->hm.size > MAX_RECYCLED_MAP)
+		{
+			free(scope->hm.map);
+			scope->hm.map = NULL;
+		}
+		else if (scope->hm.used > 0)
+		{
+			memset(scope->hm.map, 0, scope->hm.size * sizeof(Bucket));
+			scope->hm.used = 0;
+		}
+	}
+	scope->hm.asdefault = NULL;
+	scope->parent = free_scopes;
+	free_scopes = sc;
+}
+
+// A block scope on the frame stack is released before the scope below
+// it, so it can borrow the references of its parent.
 V new_scope(V parent)
 {
-	V sc = create_scope();
+	V sc = on_frame_stack(parent) ? create_frame_scope(0) : NULL;
+	bool borrow = sc != NULL;
+	if (!borrow)
+	{
+		sc = create_scope(4);
+	}
 	Scope* pscope = toScope(parent);
 	Scope* scope = toScope(sc);
 	scope->is_func_scope = false;
-	scope->is_error_handler = false;
-	scope->parent = add_ref(parent);
-	scope->func = pscope->func == NULL ? NULL : add_ref(pscope->func);
-	scope->file = pscope->file == NULL ? NULL : add_ref(pscope->file);
+	scope->is_tail_call = false;
+	scope->parent = borrow ? parent : add_ref(parent);
+	scope->func = pscope->func == NULL || borrow ? pscope->func : add_ref(pscope->func);
+	scope->file = pscope->file == NULL || borrow ? pscope->file : add_ref(pscope->file);
 	scope->pc = pscope->pc;
 	scope->linenr = pscope->linenr;
-	hashmap_from_scope(sc, 16);
+	scope->n_slots = 0;
+	scope->slots = NULL;
 	return sc;
 }
 
 V new_function_scope(V function)
 {
-	V sc = create_scope();
+	Frame* frame = toFunc(function)->start->frame;
+	V sc = frame->escapes ? NULL : create_frame_scope(frame->n_slots);
+	bool on_heap = sc == NULL;
+	if (on_heap)
+	{
+		sc = create_scope(8);
+	}
 	Scope* scope = toScope(sc);
 	scope->is_func_scope = true;
-	scope->is_error_handler = false;
+	scope->is_tail_call = false;
 	scope->parent = add_ref(toFunc(function)->defscope);
 	scope->func = add_ref(function);
 	scope->file = add_ref(toScope(scope->parent)->file);
 	scope->pc = toFunc(function)->start;
-	hashmap_from_scope(sc, 32);
+	scope->n_slots = frame->n_slots;
+	if (on_heap)
+	{ // scopes on the frame stack come with their slots
+		scope->slots = NULL;
+		if (scope->n_slots > 0)
+		{
+			scope->slots = pool_alloc(scope->n_slots * sizeof(V));
+			memset(scope->slots, 0, scope->n_slots * sizeof(V));
+		}
+	}
+	if (vm_jit)
+	{
+		jit_count_call(toFunc(function));
+	}
 	return sc;
 }
 
 V new_file_scope(V file)
 {
-	V sc = create_scope();
+	V sc = create_scope(64);
 	Scope* scope = toScope(sc);
 	scope->is_func_scope = true;
-	scope->is_error_handler = false;
+	scope->is_tail_call = false;
 	scope->parent = add_ref(toFile(file)->global);
 	scope->func = NULL;
 	scope->file = add_ref(file);
 	scope->pc = toFile(file)->code - 1;
-	hashmap_from_scope(sc, 64);
+	scope->n_slots = 0;
+	scope->slots = NULL;
 	return sc;
 }
 
 V new_global_scope(void)
 {
-	V sc = create_scope();
+	V sc = create_scope(128);
 	Scope* scope = toScope(sc);
 	scope->is_func_scope = false;
+	scope->is_tail_call = false;
 	scope->parent = NULL;
 	scope->func = NULL;
 	scope->file = NULL;
 	scope->pc = NULL;
-	hashmap_from_scope(sc, 128);
+	scope->n_slots = 0;
+	scope->slots = NULL;
+	return sc;
+}
+
+/* Flat closures.
+ * A function made by FLAT_LABDA does not keep the scope it was made in.
+ * Instead, it gets a scope of its own on top of the file scope, with
+ * the current values of the names in the CAPTURE instructions from
+ * capture on. The compiler only does this when none of those names can
+ * be bound again afterwards. Names that are not bound yet are left out:
+ * they would not be found in the scope the function was made in either.
+ */
+V new_closure_scope(V scope, Instruction* capture)
+{
+	V file_scope = scope;
+	V v;
+	while (toScope(toScope(file_scope)->parent)->parent != NULL)
+	{
+		file_scope = toScope(file_scope)->parent;
+	}
+	V sc = new_scope(file_scope);
+	for (; capture->opcode == OP_CAPTURE; capture++)
+	{
+		v = lookup_name(toScope(scope), capture->literal, NULL);
+		if (v != NULL)
+		{
+			set_in_scope(toScope(sc), capture->literal, v);
+		}
+	}
 	return sc;
 }
+
+/* Inline caches.
+ * A name that was never bound outside of file and global scopes
+ * resolves the same way from anywhere in a file, so its location can be
+ * cached per instruction. Adding such a binding bumps binding_version,
+ * which invalidates every cache at once. Changing the value of an
+ * existing binding does not, because caches hold its location.
+ */
+unsigned long binding_version = 1;
+
+void binding_added(Scope* sc, V key)
+{
+	if (sc->parent != NULL && toScope(sc->parent)->parent != NULL)
+	{
+		if (getType(key) != T_IDENT || toIdent(key)->bound_locally)
+		{
+			return;
+		}
+		toIdent(key)->bound_locally = true;
+	}
+	binding_version++;
+}
+
+/* Quickened PUSH_WORD instructions also rely on what kind of value a
+ * cached binding holds, so changing a binding to or from a function
+ * bumps binding_version as well.
+ */
+static void binding_changed(V key, V old, V value)
+{
+	if (getType(key) == T_IDENT && toIdent(key)->bound_locally)
+	{
+		return;
+	}
+	if (getType(old) == T_FUNC || getType(old) == T_CFUNC || getType(value) == T_FUNC || getType(value) == T_CFUNC)
+	{
+		binding_version++;
+	}
+}
+
+/* Slots.
+ * Names bound at the top level of a function live in the slots of its
+ * scope rather than in the hash map; the names of the slots are found
+ * in the Frame of the function. An empty slot means the name is unbound.
+ */
+static V* slot_of(Scope* sc, V key)
+{
+	int i;
+	V *names = toFunc(sc->func)->start->frame->names;
+	for (i = 0; i < sc->n_slots; i++)
+	{
+		if (names[i] == key)
+		{
+			return &sc->slots[i];
+		}
+	}
+	return NULL;
+}
+
+V* find_in_scope(Scope* sc, V key)
+{
+	V* slot;
+	if (sc->n_slots > 0 && (slot = slot_of(sc, key)) != NULL)
+	{
+		return *slot != NULL ? slot : NULL;
+	}
+	return get_hashmap_ref(&sc->hm, key);
+}
+
+bool change_in_scope(Scope* sc, V key, V value)
+{
+	V* slot = find_in_scope(sc, key);
+	if (slot == NULL)
+	{
+		return false;
+	}
+	V tmp = *slot;
+	*slot = add_ref(value);
+	binding_changed(key, tmp, value);
+	clear_ref(tmp);
+	return true;
+}
+
+void set_in_scope(Scope* sc, V key, V value)
+{
+	V* slot;
+	if (sc->n_slots > 0 && (slot = slot_of(sc, key)) != NULL)
+	{
+		V tmp = *slot;
+		*slot = add_ref(value);
+		clear_ref(tmp);
+		return;
+	}
+	slot = get_hashmap_ref(&sc->hm, key);
+	if (slot != NULL)
+	{
+		V tmp = *slot;
+		*slot = add_ref(value);
+		binding_changed(key, tmp, value);
+		clear_ref(tmp);
+		return;
+	}
+	set_hashmap(&sc->hm, key, value);
+	binding_added(sc, key);
+}
+
+// change the nearest binding of key, or bind it globally
+void set_name(Scope* sc, V key, V value)
+{
+	while (!change_in_scope(sc, key, value))
+	{
+		if (sc->parent == NULL)
+		{
+			set_in_scope(sc, key, value);
+			return;
+		}
+		sc = toScope(sc->parent);
+	}
+}
+
+V lookup_name(Scope* sc, V key, InlineCache* cache)
+{
+	V* ref = find_in_scope(sc, key);
+	while (ref == NULL)
+	{
+		if (sc->parent == NULL)
+		{
+			return NULL;
+		}
+		sc = toScope(sc->parent);
+		ref = find_in_scope(sc, key);
+	}
+	if (cache != NULL && getType(key) == T_IDENT && !toIdent(key)->bound_locally)
+	{
+		cache->key = key;
+		cache->slot = ref;
+		cache->version = binding_version;
+	}
+	return *ref;
+}
+
+// look up key, known to be slot number slot of the current function
+// blocks between the current scope and the function scope can shadow it
+V lookup_slot(Scope* sc, V key, int slot)
+{
+	V* ref;
+	while (sc->slots == NULL)
+	{
+		if (sc->hm.used > 0 && (ref = get_hashmap_ref(&sc->hm, key)) != NULL)
+		{
+			return *ref;
+		}
+		if (sc->parent == NULL)
+		{
+			return NULL;
+		}
+		sc = toScope(sc->parent);
+	}
+	if (sc->slots[slot] != NULL)
+	{
+		return sc->slots[slot];
+	}
+	return sc->parent != NULL ? lookup_name(toScope(sc->parent), key, NULL) : NULL;
+}
+
+// like set_name, for a key known to be slot number slot
+void set_slot(Scope* sc, V key, int slot, V value)
+{
+	while (sc->slots == NULL)
+	{
+		if (sc->hm.used > 0 && change_hashmap(&sc->hm, key, value))
+		{
+			return;
+		}
+		if (sc->parent == NULL)
+		{
+			set_in_scope(sc, key, value);
+			return;
+		}
+		sc = toScope(sc->parent);
+	}
+	if (sc->slots[slot] != NULL)
+	{
+		V tmp = sc->slots[slot];
+		sc->slots[slot] = add_ref(value);
+		clear_ref(tmp);
+	}
+	else
+	{
+		set_name(sc, key, value);
+	}
+}
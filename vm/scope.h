@@ -2,6 +2,7 @@
 #define SCOPE_DEF
 
 #include "hashmap.h"
+#include "instruction.h"
 
 #include <stdint.h>
 
@@ -10,27 +11,32 @@ typedef struct Scope
 	V file;
 	V func;
 	V parent;
-	int index;
 	bool is_func_scope;
-	bool is_error_handler;
+	bool is_tail_call; //replaced the scopes of its caller
 	uint32_t linenr;
-	uint32_t* pc;
+	Instruction* pc;
+	int n_slots;
+	V *slots;      //see Frame, only for function scopes
 	struct HashMap hm;
 } Scope;
 
-typedef struct
-{
-	Value v;
-	Scope sc;
-} ValueScope;
+extern unsigned long binding_version;
 
-#define MAXCACHE 1024
-ValueScope SCOPECACHE[MAXCACHE];
-int MAXSCOPE;
+V* find_in_scope(Scope*, V);
+void set_in_scope(Scope*, V, V);
+bool change_in_scope(Scope*, V, V);
+void set_name(Scope*, V, V);
+void binding_added(Scope*, V);
+V lookup_name(Scope*, V, InlineCache*);
+V lookup_slot(Scope*, V, int);
+void set_slot(Scope*, V, int, V);
 
 V new_scope(V);
 V new_function_scope(V);
 V new_file_scope(V);
 V new_global_scope(void);
+V new_closure_scope(V, Instruction*);
+void recycle_scope(V);
+bool on_frame_stack(V);
 
 #endif
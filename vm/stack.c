@@ -12,6 +12,14 @@ Stack* new_stack()
 	return nstack;
 }
 
+Stack* new_sized_stack(int size)
+{
+	Stack* nstack = new_stack();
+	nstack->size = size;
+	nstack->nodes = malloc(size * sizeof(V));
+	return nstack;
+}
+
 void copy_stack(Stack *old, Stack *new)
 {
 	if (old->nodes != NULL)
@@ -31,19 +39,30 @@ void copy_stack(Stack *old, Stack *new)
 	new->size = old->size;
 }
 
-void push(Stack *stack, V v)
+void grow_stack(Stack *stack)
+{
+	stack->size = stack->size > 0 ? stack->size * 2 : MIN_STACK;
+	stack->nodes = realloc(stack->nodes, stack->size * sizeof(V));
+}
+
+// halve the room of stack while it uses less than a quarter of it
+void shrink_stack(Stack *stack, int min)
 {
-	if (stack->nodes == NULL)
+	int size = stack->size;
+	while (size / 2 >= min && stack->used < size / 4)
 	{
-		stack->size = 64;
-		stack->nodes = calloc(stack->size, sizeof(V));
+		size /= 2;
 	}
-	if (stack->used == stack->size)
+	if (size != stack->size)
 	{
-		stack->size *= 2;
-		stack->nodes = realloc(stack->nodes, stack->size * sizeof(V));
+		stack->size = size;
+		stack->nodes = realloc(stack->nodes, size * sizeof(V));
 	}
-	stack->nodes[stack->used++] = v;
+}
+
+void push(Stack *stack, V v)
+{
+	push_fast(stack, v);
 }
 
 void reverse(Stack *stack)
@@ -63,17 +82,7 @@ void reverse(Stack *stack)
 
 V pop(Stack *stack)
 {
-	if (stack->used > 0)
-	{
-		V v = stack->nodes[--stack->used];
-		if (stack->used < (stack->size / 4) && stack->size > 64)
-		{
-			stack->size /= 2;
-			stack->nodes = realloc(stack->nodes, stack->size * sizeof(V));
-		}
-		return v;
-	}
-	return NULL;
+	return pop_fast(stack);
 }
 
 void clear_stack(Stack *stack)
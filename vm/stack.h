@@ -6,6 +6,32 @@
 #define get_head(x) (x->nodes[x->used - 1])
 #define stack_size(x) (x->used)
 
+/* The operand stack S is pushed and popped for nearly every
+ * instruction, so pushS and popS work on it in place. Run gives S room
+ * for STACK_SEGMENT values up front; a push only checks whether it is
+ * full, and a pop whether it is empty. Stacks never shrink when popped:
+ * shrink_stack gives memory back at points where it is safe, so
+ * a stack that keeps growing and shrinking does not realloc every time.
+ */
+#define STACK_SEGMENT 4096
+#define MIN_STACK 64
+
+#define push_fast(x, v) \
+	do \
+	{ \
+		V pushed = (v); \
+		if ((x)->used == (x)->size) \
+		{ \
+			grow_stack(x); \
+		} \
+		(x)->nodes[(x)->used++] = pushed; \
+	} \
+	while (0)
+#define pop_fast(x) ((x)->used > 0 ? (x)->nodes[--(x)->used] : NULL)
+
+#define pushS(v) push_fast(S, add_rooted(v))
+#define popS() clear_rooted(pop_fast(S))
+
 typedef struct
 {
 	int size;
@@ -14,6 +40,9 @@ typedef struct
 } Stack;
 
 Stack* new_stack();
+Stack* new_sized_stack(int);
+void grow_stack(Stack*);
+void shrink_stack(Stack*, int);
 void copy_stack(Stack*, Stack*);
 void push(Stack*, V);
 void reverse(Stack*);
@@ -10,16 +10,98 @@ utf8index nextchar(utf8 chars, utf8index start)
 	return start;
 }
 
+/* Hashing.
+ * new_string_hash follows wyhash: it reads the key 8 or 16 bytes at a
+ * time and folds it in with 64x64->128 bit multiplications, xoring the
+ * two halves of each product. Keys of up to 16 bytes, the usual case,
+ * take two overlapping reads and two multiplications. mix_hash does
+ * the same for a single word, for numbers and pairs.
+ */
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+#define HASH_P3 0x589965cc75374cc3ull
+
+static inline uint64_t mum(uint64_t a, uint64_t b)
+{
+	unsigned __int128 r = (unsigned __int128)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
 uint32_t new_string_hash(size_t length, const char *key)
 {
-	uint32_t hash = 2166136261;
-	size_t i;
-	for (i = 0; i < length; i++)
+	const uint8_t *p = (const uint8_t*)key;
+	uint64_t seed = HASH_P0;
+	uint64_t see1, see2;
+	uint64_t a, b, h;
+	unsigned __int128 r;
+	size_t i = length;
+	if (length <= 16)
+	{
+		if (length >= 4)
+		{ // two overlapping reads from each end
+			a = (read32(p) << 32) | read32(p + ((length >> 3) << 2));
+			b = (read32(p + length - 4) << 32) | read32(p + length - 4 - ((length >> 3) << 2));
+		}
+		else if (length > 0)
+		{
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+			b = 0;
+		}
+		else
+		{
+			a = b = 0;
+		}
+	}
+	else
 	{
-		hash = (16777619 * hash) ^ (*key);
-		key++;
+		if (i > 48)
+		{ // three independent lanes
+			see1 = see2 = seed;
+			do
+			{
+				seed = mum(read64(p) ^ HASH_P1, read64(p + 8) ^ seed);
+				see1 = mum(read64(p + 16) ^ HASH_P2, read64(p + 24) ^ see1);
+				see2 = mum(read64(p + 32) ^ HASH_P3, read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			}
+			while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16)
+		{
+			seed = mum(read64(p) ^ HASH_P1, read64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = read64(p + i - 16);
+		b = read64(p + i - 8);
 	}
-	return hash;
+	r = (unsigned __int128)(a ^ HASH_P1) * (b ^ seed);
+	h = mum((uint64_t)r ^ HASH_P0 ^ length, (uint64_t)(r >> 64) ^ HASH_P1);
+	return h ^ (h >> 32);
+}
+
+uint32_t mix_hash(uint64_t x)
+{
+	uint64_t h = mum(x ^ HASH_P0, HASH_P1);
+	h = mum(h ^ HASH_P2, HASH_P3);
+	return h ^ (h >> 32);
 }
 
 size_t count_characters(size_t size, const utf8 chars)
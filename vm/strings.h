@@ -16,6 +16,8 @@ typedef struct {
 	utf8byte text[1];
 } __attribute__((packed)) NewString;
 
+uint32_t new_string_hash(size_t, const char*);
+uint32_t mix_hash(uint64_t);
 uint32_t need_hash(V);
 uint32_t string_length(NewString*);
 V charat(utf8, utf8index);
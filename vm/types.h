@@ -10,6 +10,8 @@
 #define T_DICT 0x05
 #define T_PAIR 0x06
 #define T_FRAC 0x07
+#define T_BIGINT 0x08
+#define T_BIGFRAC 0x09
 // Section 0x1*: internal types
 #define T_SCOPE 0x10
 #define T_FILE 0x11
@@ -2,10 +2,12 @@
 #include "hashmap.h"
 #include "idents.h"
 #include "strings.h"
+#include "bigint.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <limits.h>
 
 #define make_value_from_double(d) \
 	V t = make_new_value(T_NUM, true, sizeof(double)); \
@@ -18,15 +20,20 @@ V int_to_value(long int i)
 	{
 		return intToV(i);
 	}
-	make_value_from_double((double)i);
+	return int128_to_value(i);
 }
 
 V double_to_value(double d)
 {
+	uint64_t bits = doubleToBits(d);
 	if (!fmod(d, 1.0) && canBeInt(d))
 	{
 		return intToV((long int)d);
 	}
+	if (canBeDouble(bits))
+	{
+		return doubleToV(bits);
+	}
 	make_value_from_double(d);
 }
 
@@ -53,9 +60,10 @@ V new_sized_dict(int size)
 
 V new_pair(V first, V second)
 {
-	V t = make_new_value(T_PAIR, true, sizeof(V) * 2);
+	V t = make_new_value(T_PAIR, true, sizeof(V) * 2 + sizeof(uint32_t));
 	toFirst(t) = first;
 	toSecond(t) = second;
+	toPairHash(t) = 0;
 	return t;
 }
 
@@ -70,57 +78,138 @@ long int pair_ordinal(V p)
 	return (o1 > o2 ? o1 : o2) + 1;
 }
 
-frac_long gcd(frac_long u, frac_long v)
+/* Fractions.
+ * Every fraction is kept reduced, with a positive denominator, so the
+ * kernels below can reduce early: frac_add only needs the gcd of the
+ * denominators, frac_mul cross-cancels before multiplying. Products of
+ * two 64 bit parts fit in a frac_long. A whole result becomes an int or
+ * BigInt; any other result whose parts do not fit in a long any more
+ * becomes a BigFrac.
+ */
+static int ctz128(unsigned __int128 x)
 {
-  // simple cases (termination)
-  if (u == v)
-    return u;
-  if (u == 0)
-    return v;
-  if (v == 0)
-    return u;
+	uint64_t low = (uint64_t)x;
+	return low ? __builtin_ctzll(low) : 64 + __builtin_ctzll((uint64_t)(x >> 64));
+}
 
-  // look for factors of 2
-  if (~u & 1) // u is even
-  {
-    if (v & 1) // v is odd
-      return gcd(u >> 1, v);
-    else // both u and v are even
-      return gcd(u >> 1, v >> 1) << 1;
-  }
-  if (~v & 1) // u is odd, v is even
-    return gcd(u, v >> 1);
+// binary gcd of two non-negative numbers
+static frac_long gcd(frac_long a, frac_long b)
+{
+	unsigned __int128 u = a;
+	unsigned __int128 v = b;
+	unsigned __int128 t;
+	int shift;
+	if (u == 0 || v == 0)
+	{
+		return u | v;
+	}
+	shift = ctz128(u | v);
+	u >>= ctz128(u);
+	if ((u | v) >> 64 == 0)
+	{ // the usual case, in 64 bits
+		uint64_t u64 = u;
+		uint64_t v64 = v;
+		do
+		{
+			v64 >>= __builtin_ctzll(v64);
+			if (u64 > v64)
+			{
+				uint64_t t64 = u64;
+				u64 = v64;
+				v64 = t64;
+			}
+			v64 -= u64;
+		}
+		while (v64 != 0);
+		return (frac_long)u64 << shift;
+	}
+	do
+	{
+		v >>= ctz128(v);
+		if (u > v)
+		{
+			t = u;
+			u = v;
+			v = t;
+		}
+		v -= u;
+	}
+	while (v != 0);
+	return u << shift;
+}
 
-  // reduce larger argument
-  if (u > v)
-    return gcd((u - v) >> 1, v);
-  return gcd((v - u) >> 1, u);
+static frac_long frac_abs(frac_long n)
+{
+	return n < 0 ? -n : n;
 }
 
-V new_frac(frac_long numerator, frac_long denominator)
+// numerator / denominator, which are reduced, with denominator > 0
+static V reduced_frac(frac_long numerator, frac_long denominator)
 {
+	V t;
 	if (numerator == 0)
+	{
 		return intToV(0);
-	long int m = 1;
-	if (numerator < 0)
+	}
+	if (denominator == 1)
 	{
-		numerator = -numerator;
-		m = -m;
+		return int128_to_value(numerator);
+	}
+	if (canBeSmallFrac(numerator, denominator))
+	{
+		return smallFracToV(numerator, denominator);
+	}
+	if (numerator < LONG_MIN || numerator > LONG_MAX || denominator > LONG_MAX)
+	{
+		return new_bigfrac(int128_to_value(numerator), int128_to_value(denominator));
 	}
+	t = make_new_value(T_FRAC, true, sizeof(Frac));
+	toFrac(t)->numerator = numerator;
+	toFrac(t)->denominator = denominator;
+	return t;
+}
+
+V new_frac(frac_long numerator, frac_long denominator)
+{
+	frac_long divisor;
+	if (numerator == 0)
+		return intToV(0);
 	if (denominator < 0)
 	{
+		numerator = -numerator;
 		denominator = -denominator;
-		m = -m;
 	}
-	long int divisor = gcd(numerator, denominator);
-	numerator = m * (numerator / divisor);
-	denominator = denominator / divisor;
-	if (denominator == 1)
-		return int_to_value(numerator);
-	V t = make_new_value(T_FRAC, true, sizeof(Frac));
-	toNumerator(t) = numerator;
-	toDenominator(t) = denominator;
-	return t;
+	divisor = gcd(frac_abs(numerator), denominator);
+	return reduced_frac(numerator / divisor, denominator / divisor);
+}
+
+// a/b + c/d, for reduced fractions with parts that fit in a long
+V frac_add(frac_long a, frac_long b, frac_long c, frac_long d)
+{
+	frac_long g = gcd(b, d);
+	frac_long g2;
+	frac_long t;
+	if (g == 1)
+	{
+		return reduced_frac(a * d + c * b, b * d);
+	}
+	t = a * (d / g) + c * (b / g);
+	g2 = gcd(frac_abs(t), g);
+	return reduced_frac(t / g2, (b / g) * (d / g2));
+}
+
+// a/b * c/d, for reduced fractions with parts that fit in a long
+V frac_mul(frac_long a, frac_long b, frac_long c, frac_long d)
+{
+	frac_long g1;
+	frac_long g2;
+	if (a == 0 || c == 0)
+	{
+		return intToV(0);
+	}
+	g1 = gcd(frac_abs(a), d);
+	g2 = gcd(frac_abs(c), b);
+	return reduced_frac((a / g1) * (c / g2), (b / g2) * (d / g1));
 }
 
 bool truthy(V t)
@@ -152,6 +241,16 @@ bool equal(V v1, V v2)
 	{
 		if (getType(v1) == T_NUM)
 		{
+			if (isInt(v1) && isInt(v2))
+			{ // not identical, so different
+				return false;
+			}
+			if (isInt(v1) || isInt(v2))
+			{ // above 2^53 an int and a double can differ when compared as doubles
+				long int i = isInt(v1) ? toInt(v1) : toInt(v2);
+				double d = isInt(v1) ? toNumber(v2) : toNumber(v1);
+				return d == (double)i && d >= -0x1p63 && d < 0x1p63 && (long int)d == i;
+			}
 			return toNumber(v1) == toNumber(v2);
 		}
 		else if (getType(v1) == T_STR)
@@ -173,6 +272,15 @@ bool equal(V v1, V v2)
 			return toNumerator(v1) == toNumerator(v2) &&
 				toDenominator(v1) == toDenominator(v2);
 		}
+		else if (getType(v1) == T_BIGINT)
+		{
+			return bigint_equal(v1, v2);
+		}
+		else if (getType(v1) == T_BIGFRAC)
+		{ // both are reduced
+			return !bigint_cmp(toBigFrac(v1)->numerator, toBigFrac(v2)->numerator) &&
+				!bigint_cmp(toBigFrac(v1)->denominator, toBigFrac(v2)->denominator);
+		}
 	}
 	return false;
 }
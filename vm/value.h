@@ -4,10 +4,35 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/* Values are at least 8 byte aligned, so a V only points to a Value
+ * if its low three bits are 0. Otherwise it is a number by itself:
+ *  ...1  a 63 bit integer
+ *  ..10  a double with an exponent between -255 and 256. Then the top
+ *        three bits of the exponent are 011 or 100, so the last two
+ *        follow from the first. The bits are rotated left by 4,
+ *        putting those two at the bottom, where the tag replaces them.
+ *  0100  the booleans: false is 0.0 and true is 1.0, in bit 4
+ *  1100  a fraction, with a 32 bit numerator in the high half and a
+ *        28 bit denominator above the tag
+ * Other doubles and fractions are still allocated as Values.
+ */
 #define isInt(x) ((long int)x & 1)
 #define canBeInt(x) (x > INTPTR_MIN >> 1 && x < INTPTR_MAX >> 1)
 #define toInt(x) ((long int)x>>1)
 #define intToV(x) ((V)(((x) << 1) + 1))
+#define isPointer(x) (((uintptr_t)(x) & 7) == 0)
+#define isDouble(x) (((uintptr_t)(x) & 3) == 2)
+#define isBool(x) (((uintptr_t)(x) & 15) == 4)
+#define boolToV(b) ((V)(uintptr_t)((b) ? 20 : 4))
+#define isSmallFrac(x) (((uintptr_t)(x) & 15) == 12)
+#define canBeSmallFrac(n, d) ((n) >= INT32_MIN && (n) <= INT32_MAX && (d) < (1 << 28))
+#define smallFracToV(n, d) ((V)(uintptr_t)(((uint64_t)(n) << 32) | ((uint64_t)(d) << 4) | 12))
+#define bitsToDouble(b) (((union {uint64_t i; double d;}){.i = (b)}).d)
+#define doubleToBits(f) (((union {double d; uint64_t i;}){.d = (f)}).i)
+#define canBeDouble(b) (((((b) >> 60) - 3) & 7) < 2)
+#define doubleToV(b) ((V)(uintptr_t)(((((uint64_t)(b) << 4) | ((uint64_t)(b) >> 60)) & ~(uint64_t)3) | 2))
+#define unrotated(r) (((r) & ~(uint64_t)3) | ((r) & 4 ? 0 : 3))
+#define toImmediateDouble(x) bitsToDouble((unrotated((uint64_t)(uintptr_t)(x)) >> 4) | (unrotated((uint64_t)(uintptr_t)(x)) << 60))
 
 #define toFile(x) ((File*)(x + 1))
 #define toScope(x) ((Scope*)(x + 1))
@@ -15,22 +40,22 @@
 #define toStack(x) ((Stack*)(x + 1))
 #define toIdent(x) ((ITreeNode*)(x))
 #define toDouble(x) (*(double*)(x + 1))
-#define toNumber(x) (isInt(x) ? (double)toInt(x) : toDouble(x))
+#define toNumber(x) (isInt(x) ? (double)toInt(x) : isPointer(x) ? toDouble(x) : \
+	isDouble(x) ? toImmediateDouble(x) : (double)((uintptr_t)(x) >> 4))
 #define toCFunc(x) (*(CFuncP*)(x + 1))
 #define toHashMap(x) ((HashMap*)(x + 1))
-#define getType(x) (isInt(x) ? T_NUM : x->type)
+#define getType(x) (isPointer(x) ? x->type : isSmallFrac(x) ? T_FRAC : T_NUM)
 #define toFirst(x) (*((V*)(x + 1)))
 #define toSecond(x) (*((V*)(x + 2)))
-#define toNumerator(x) (((Frac*)(x + 1))->numerator)
-#define toDenominator(x) (((Frac*)(x + 1))->denominator)
+#define toPairHash(x) (*((uint32_t*)(x + 3))) // 0 until get_hash needs it
+#define toFrac(x) ((Frac*)(x + 1))
+#define toNumerator(x) (isPointer(x) ? toFrac(x)->numerator : (long int)((intptr_t)(x) >> 32))
+#define toDenominator(x) (isPointer(x) ? toFrac(x)->denominator : (long int)(((uintptr_t)(x) >> 4) & 0xFFFFFFF))
 #define getNumer(x) ((frac_long)toNumerator(x))
 #define getDenom(x) ((frac_long)toDenominator(x))
 
 #define new_dict() new_sized_dict(16)
 
-#define pushS(v) push(S, add_rooted(v))
-#define popS() clear_rooted(pop(S))
-
 // Déjà Vu utilises the synchronous cycle collection algorithm
 // described by David F. Bacon and V.T. Rajan (2001)
 typedef enum GCColor
@@ -62,8 +87,8 @@ typedef struct
 typedef struct TreeNode {
 	uint8_t type;
 	uint32_t length;
-	struct TreeNode *left;
-	struct TreeNode *right;
+	bool bound_locally; // ever bound outside of file and global scopes
+	uint32_t hash;
 	char data[1]; // That length is a white lie.
 } ITreeNode;
 
@@ -78,6 +103,8 @@ V new_list();
 V new_sized_dict();
 V new_pair(V, V);
 V new_frac(frac_long, frac_long);
+V frac_add(frac_long, frac_long, frac_long, frac_long);
+V frac_mul(frac_long, frac_long, frac_long, frac_long);
 
 bool truthy(V);
 bool equal(V, V);
@@ -0,0 +1,250 @@
+#include <stdlib.h>
+
+#include "verify.h"
+#include "opcodes.h"
+
+/* The verifier.
+ * load_memfile runs all code through verify_code before it can run.
+ * Code that jumps outside of itself, can run past its end, or has a
+ * superinstruction without its second half is rejected.
+ *
+ * It then computes for every instruction how many values are known to
+ * be on the stack when it starts, relative to the start of its
+ * function or file. This is a lower bound, found by following every
+ * path through the code: where paths meet, the smallest depth wins,
+ * and anything that can call a function or CFunc resets it to 0,
+ * because those can take as much from the stack as they like.
+ * An instruction that needs n values and is known to find n is
+ * switched to its UNCHECKED variant, which skips the REQUIRE.
+ */
+
+#define UNREACHED -1
+
+// the number of values op needs, and what it leaves of d values
+static int stack_effect(uint32_t op, int d, int *needs)
+{
+	int n = 0;
+	int after;
+	switch (op)
+	{
+		case OP_PUSH_LITERAL:
+		case OP_PUSH_INTEGER:
+		case OP_GET:
+		case OP_GET_GLOBAL:
+		case OP_GET_SLOT:
+		case OP_NEW_LIST:
+		case OP_NEW_DICT:
+		case OP_LABDA:
+		case OP_FLAT_LABDA:
+			after = d + 1;
+			break;
+		case OP_PUSH_WORD:
+		case OP_TAILCALL:
+		case OP_PUSH_SLOT:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_LT:
+		case OP_GT:
+		case OP_LE:
+		case OP_GE:
+		case OP_EQ:
+		case OP_LT_JMPZ:
+		case OP_GT_JMPZ:
+		case OP_LE_JMPZ:
+		case OP_GE_JMPZ:
+		case OP_EQ_JMPZ:
+			after = 0;
+			break;
+		case OP_CALL:
+			n = 1;
+			after = 0;
+			break;
+		case OP_SET:
+		case OP_SET_LOCAL:
+		case OP_SET_GLOBAL:
+		case OP_SET_SLOT:
+		case OP_SET_LOCAL_SLOT:
+		case OP_JMPZ:
+		case OP_DROP:
+		case OP_RAISE:
+		case OP_RERAISE:
+			n = 1;
+			after = (d > n ? d : n) - 1;
+			break;
+		case OP_JMPEQ:
+		case OP_JMPNE:
+		case OP_PUSH_TO:
+			n = 2;
+			after = (d > n ? d : n) - 2;
+			break;
+		case OP_HAS_DICT:
+		case OP_GET_DICT:
+		case OP_PUSH_THROUGH:
+			n = 2;
+			after = (d > n ? d : n) - 1;
+			break;
+		case OP_POP_FROM:
+			n = 1;
+			after = d > n ? d : n;
+			break;
+		case OP_SET_DICT:
+			n = 3;
+			after = (d > n ? d : n) - 3;
+			break;
+		case OP_DUP:
+		case OP_DUP_JMPZ:
+			n = 1;
+			after = (d > n ? d : n) + 1;
+			break;
+		case OP_SWAP:
+			n = 2;
+			after = d > n ? d : n;
+			break;
+		case OP_ROT:
+			n = 3;
+			after = d > n ? d : n;
+			break;
+		case OP_OVER:
+			n = 2;
+			after = (d > n ? d : n) + 1;
+			break;
+		default:
+			after = d;
+			break;
+	}
+	*needs = n;
+	return after;
+}
+
+// lower the known depth at i to d, if that is new information
+static void flow(int *depth, uint32_t *work, uint32_t *n_work, uint32_t i, int d)
+{
+	if (depth[i] == UNREACHED || d < depth[i])
+	{
+		depth[i] = d;
+		work[(*n_work)++] = i;
+	}
+}
+
+static bool in_code(uint32_t i, int32_t offset, uint32_t size)
+{
+	return (int64_t)i + offset >= 0 && (int64_t)i + offset < size;
+}
+
+bool verify_code(Instruction *code, uint32_t size)
+{
+	int *depth = malloc(size * sizeof(int));
+	uint32_t capacity = size;
+	uint32_t *work = malloc(capacity * sizeof(uint32_t));
+	uint32_t n_work = 0;
+	uint32_t i;
+	int32_t arg;
+	int d;
+	int n;
+	bool ok = false;
+	for (i = 0; i < size; i++)
+	{
+		depth[i] = UNREACHED;
+		arg = code[i].arg;
+		switch (code[i].opcode)
+		{
+			case OP_JMP:
+			case OP_JMPZ:
+			case OP_JMPEQ:
+			case OP_JMPNE:
+			case OP_LABDA:
+			case OP_FLAT_LABDA:
+			case OP_ENTER_ERRHAND:
+				if (!in_code(i, arg, size))
+				{
+					goto done;
+				}
+				break;
+			case OP_DUP_JMPZ:
+			case OP_LT_JMPZ:
+			case OP_GT_JMPZ:
+			case OP_LE_JMPZ:
+			case OP_GE_JMPZ:
+			case OP_EQ_JMPZ:
+				if (i + 1 >= size || code[i + 1].opcode != OP_JMPZ)
+				{
+					goto done;
+				}
+				break;
+			case OP_LEAVE_SCOPE_JMP:
+				if (i + 1 >= size || code[i + 1].opcode != OP_JMP)
+				{
+					goto done;
+				}
+				break;
+			case OP_PUSH_WORD_CFUNC:
+			case OP_PUSH_WORD_FUNC:
+			case OP_PUSH_WORD_VALUE:
+				// only PUSH_WORD itself writes these
+				goto done;
+		}
+	}
+	if (size == 0)
+	{
+		goto done;
+	}
+	flow(depth, work, &n_work, 0, 0);
+	while (n_work > 0)
+	{
+		i = work[--n_work];
+		d = stack_effect(code[i].opcode, depth[i], &n);
+		arg = code[i].arg;
+		if (n_work + 2 > capacity)
+		{
+			capacity *= 2;
+			work = realloc(work, capacity * sizeof(uint32_t));
+		}
+		switch (code[i].opcode)
+		{
+			case OP_JMP:
+				flow(depth, work, &n_work, i + arg, d);
+				continue;
+			case OP_JMPZ:
+			case OP_JMPEQ:
+			case OP_JMPNE:
+				flow(depth, work, &n_work, i + arg, d);
+				break;
+			case OP_LABDA:
+			case OP_FLAT_LABDA:
+				// the body starts a function of its own
+				flow(depth, work, &n_work, i + 1, 0);
+				flow(depth, work, &n_work, i + arg, d);
+				continue;
+			case OP_ENTER_ERRHAND:
+				// the body runs at the target; the handler after
+				// this instruction starts with the error on the stack
+				flow(depth, work, &n_work, i + arg, d);
+				flow(depth, work, &n_work, i + 1, 1);
+				continue;
+			case OP_RETURN:
+			case OP_RECURSE:
+			case OP_RAISE:
+			case OP_RERAISE:
+				continue;
+		}
+		if (i + 1 >= size)
+		{ // running off the end
+			goto done;
+		}
+		flow(depth, work, &n_work, i + 1, d);
+	}
+	for (i = 0; i < size; i++)
+	{
+		stack_effect(code[i].opcode, depth[i], &n);
+		if (n > 0 && depth[i] >= n)
+		{
+			code[i].opcode = UNCHECKED(code[i].opcode);
+		}
+	}
+	ok = true;
+done:
+	free(depth);
+	free(work);
+	return ok;
+}
@@ -0,0 +1,11 @@
+#ifndef VERIFY_DEF
+#define VERIFY_DEF
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+bool verify_code(Instruction*, uint32_t);
+
+#endif
@@ -9,10 +9,14 @@
 #include "error.h"
 #include "module.h"
 #include "strings.h"
+#include "gc.h"
+#include "profile.h"
+#include "jit.h"
 
 extern bool vm_silent;
 extern bool vm_debug;
 extern bool vm_persist;
+extern bool vm_gc_stats;
 
 int main(int argc, char *argv[])
 {
@@ -22,6 +26,12 @@ int main(int argc, char *argv[])
 		{"version", no_argument, NULL, 'v'},
 		{"silent", no_argument, NULL, 's'},
 		{"persist", no_argument, NULL, 'p'},
+		{"gc-roots", required_argument, NULL, 'R'},
+		{"gc-slice", required_argument, NULL, 'L'},
+		{"gc-stats", no_argument, NULL, 'G'},
+		{"profile", optional_argument, NULL, 'P'},
+		{"opcode-stats", no_argument, NULL, 'O'},
+		{"jit", no_argument, NULL, 'J'},
 		{0, 0, 0, 0},
 	};
 	char opt;
@@ -37,7 +47,16 @@ int main(int argc, char *argv[])
 			     "  -d, --debug    Enable debugging\n"
 			     "  -s, --silent   Do not print the stack after running\n"
 			     "  -p, --persist  Use standard input and output to persist the stack\n"
-			     "                 This option is intended for internal use; implies --silent");
+			     "                 This option is intended for internal use; implies --silent\n"
+			     "      --gc-roots=N  Look for garbage cycles after N candidates (default 1024)\n"
+			     "      --gc-slice=N  Look at N candidates at a time from the run loop,\n"
+			     "                    instead of all at once (default 0: all at once)\n"
+			     "      --gc-stats    Print allocation and garbage collection statistics on exit\n"
+			     "      --profile[=NAME]  Profile the program, writing a flat profile to NAME.txt\n"
+			     "                    and folded stacks to NAME.folded (default vu-profile)\n"
+			     "      --opcode-stats  Print how often each opcode and pair of opcodes ran\n"
+			     "      --jit         Compile functions that are called often to machine code\n"
+			     "                    (x86-64 only), listing them in /tmp/perf-PID.map");
 			return 0;
 		case 'v':
 			printf("vu virtual machine 0.1\nbyte code protocol %d.%d\n", VERSION >> 4, VERSION & 15);
@@ -52,13 +71,40 @@ int main(int argc, char *argv[])
 			vm_persist = true;
 			vm_silent = true;
 			break;
+		case 'R':
+			gc_root_limit = atoi(optarg);
+			if (gc_root_limit < 1)
+			{
+				fputs("vu: --gc-roots needs a positive number\n", stderr);
+				return 1;
+			}
+			break;
+		case 'L':
+			gc_slice = atoi(optarg);
+			break;
+		case 'G':
+			vm_gc_stats = true;
+			break;
+		case 'O':
+			vm_opcode_stats = true;
+			break;
+		case 'J':
+			vm_jit = true;
+			break;
+		case 'P':
+			vm_profile = true;
+			if (optarg != NULL)
+			{
+				vm_profile_name = optarg;
+			}
+			break;
 		}
 	}
 	if (argc - optind > 0)
 	{
 		init_path();
 		init_errors();
-		Stack *S = new_stack();
+		Stack *S = new_sized_stack(STACK_SEGMENT);
 
 		for (i = argc - 1; i > optind; i--)
 		{